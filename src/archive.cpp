@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "archive.h"
+
+void LogPrint(const char* format, ...);
+
+bool FileSeek(FILE *file, uint64_t pos);
+uint64_t FileTell(FILE *file);
+
+bool BeginArchive(ArchiveWriter &archive, const char *fileName)
+{
+	strcpy(archive.fileName, fileName);
+
+	archive.entries.clear();
+	archive.names.clear();
+
+	// Offset 0 is an empty name
+	archive.names.push_back(0);
+
+	archive.file = fopen(fileName, "wb");
+
+	if(!archive.file)
+	{
+		LogPrint("Failed to open '%s' for writing\r\n", fileName);
+		return false;
+	}
+
+	setvbuf(archive.file, NULL, _IOFBF, 1 << 20);
+
+	// Header is saved again once the table is written
+	Export::ArchiveInfo info;
+	memset(&info, 0, sizeof(info));
+
+	fwrite(&info, sizeof(info), 1, archive.file);
+
+	return true;
+}
+
+// Pads the archive with zeros up to the alignment and adds an entry at that position
+Export::ArchiveEntry& StartArchiveEntry(ArchiveWriter &archive, const char *name, unsigned alignment)
+{
+	static const char zeros[Export::GeometryPageSize] = {};
+
+	uint64_t pos = FileTell(archive.file);
+	uint64_t offset = (pos + alignment - 1) / alignment * alignment;
+
+	for(uint64_t padding = offset - pos; padding > 0;)
+	{
+		size_t part = padding < sizeof(zeros) ? size_t(padding) : sizeof(zeros);
+
+		fwrite(zeros, 1, part, archive.file);
+		padding -= part;
+	}
+
+	Export::ArchiveEntry entry;
+	memset(&entry, 0, sizeof(entry));
+
+	entry.nameHash = Export::NameHash(name);
+	entry.nameOffset = unsigned(archive.names.size());
+	entry.offset = offset;
+
+	archive.names.insert(archive.names.end(), name, name + strlen(name) + 1);
+	archive.entries.push_back(entry);
+
+	return archive.entries.back();
+}
+
+bool AddArchiveEntry(ArchiveWriter &archive, const char *name, const void *data, size_t size, unsigned alignment)
+{
+	Export::ArchiveEntry &entry = StartArchiveEntry(archive, name, alignment);
+
+	entry.size = size;
+
+	return size == 0 || fwrite(data, 1, size, archive.file) == size;
+}
+
+bool AddArchiveFile(ArchiveWriter &archive, const char *name, FILE *source, unsigned alignment)
+{
+	Export::ArchiveEntry &entry = StartArchiveEntry(archive, name, alignment);
+
+	std::vector<char> buffer(1 << 20);
+
+	FileSeek(source, 0);
+
+	while(size_t read = fread(buffer.data(), 1, buffer.size(), source))
+	{
+		if(fwrite(buffer.data(), 1, read, archive.file) != read)
+			return false;
+
+		entry.size += read;
+	}
+
+	return true;
+}
+
+bool EndArchive(ArchiveWriter &archive)
+{
+	if(!archive.file)
+		return false;
+
+	Export::ArchiveInfo info;
+	memset(&info, 0, sizeof(info));
+
+	info.header = 0x57bea5c1;
+	info.version = 1;
+	info.entryCount = unsigned(archive.entries.size());
+	info.bucketCount = 1;
+
+	while(info.bucketCount < info.entryCount)
+		info.bucketCount *= 2;
+
+	// Entries are sorted by bucket, a stable sort keeps the order in which they were saved
+	unsigned mask = info.bucketCount - 1;
+
+	std::stable_sort(archive.entries.begin(), archive.entries.end(), [mask](const Export::ArchiveEntry &lhs, const Export::ArchiveEntry &rhs){ return (lhs.nameHash & mask) < (rhs.nameHash & mask); });
+
+	std::vector<unsigned> buckets(info.bucketCount + 1, 0);
+
+	for(unsigned i = 0; i < archive.entries.size(); i++)
+		buckets[(archive.entries[i].nameHash & mask) + 1]++;
+
+	for(unsigned i = 0; i < info.bucketCount; i++)
+		buckets[i + 1] += buckets[i];
+
+	uint64_t pos = FileTell(archive.file);
+
+	info.tableOffset = (pos + Export::MeshSectionAlignment - 1) / Export::MeshSectionAlignment * Export::MeshSectionAlignment;
+
+	static const char zeros[Export::MeshSectionAlignment] = {};
+	fwrite(zeros, 1, size_t(info.tableOffset - pos), archive.file);
+
+	if(!archive.entries.empty())
+		fwrite(archive.entries.data(), sizeof(Export::ArchiveEntry), archive.entries.size(), archive.file);
+
+	fwrite(buckets.data(), 4, buckets.size(), archive.file);
+
+	unsigned nameDataSize = unsigned(archive.names.size());
+
+	fwrite(&nameDataSize, 4, 1, archive.file);
+	fwrite(archive.names.data(), 1, archive.names.size(), archive.file);
+
+	info.fileSize = FileTell(archive.file);
+
+	FileSeek(archive.file, 0);
+	fwrite(&info, sizeof(info), 1, archive.file);
+
+	bool result = ferror(archive.file) == 0;
+
+	result &= fclose(archive.file) == 0;
+	archive.file = NULL;
+
+	LogPrint("Saved %d files to archive '%s' (%d KB, %d buckets)\r\n", info.entryCount, archive.fileName, unsigned(info.fileSize / 1024), info.bucketCount);
+
+	return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <cstdint>
+
+#include <vector>
+
+#include "export.h"
+
+// Writer of an archive with all output files of a scene, entries are appended as they are saved and the table is written at the end
+struct ArchiveWriter
+{
+	ArchiveWriter(): file(NULL)
+	{
+	}
+
+	FILE *file;
+	char fileName[512];
+
+	std::vector<Export::ArchiveEntry> entries;
+	std::vector<char> names;
+};
+
+bool BeginArchive(ArchiveWriter &archive, const char *fileName);
+bool EndArchive(ArchiveWriter &archive);
+
+// Data of the entry starts at a multiple of the alignment
+bool AddArchiveEntry(ArchiveWriter &archive, const char *name, const void *data, size_t size, unsigned alignment);
+
+// Contents of a file that was written on its own, it is read from the start
+bool AddArchiveFile(ArchiveWriter &archive, const char *name, FILE *source, unsigned alignment);
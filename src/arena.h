@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for the data of a single file conversion, everything is released at once
+class Arena
+{
+public:
+	Arena(): allocationCount(0), allocationSize(0), current(NULL), offset(0), size(0)
+	{
+	}
+
+	~Arena()
+	{
+		Reset();
+	}
+
+	void* Allocate(size_t bytes)
+	{
+		bytes = (bytes + 15) & ~size_t(15);
+
+		if(!current || offset + bytes > size)
+			NewBlock(bytes);
+
+		void *ptr = current + offset;
+		offset += bytes;
+
+		allocationCount++;
+		allocationSize += bytes;
+
+		return ptr;
+	}
+
+	// Array elements are not initialized, same as with new[] of plain data
+	template<typename T>
+	T* AllocateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+
+		return static_cast<T*>(Allocate(sizeof(T) * count));
+	}
+
+	// Objects with destructors are destroyed on reset
+	template<typename T>
+	T* Create()
+	{
+		T *object = new(Allocate(sizeof(T))) T();
+
+		if(!std::is_trivially_destructible<T>::value)
+			finalizers.push_back(Finalizer(object, &Destroy<T>));
+
+		return object;
+	}
+
+	char* Duplicate(const char *str)
+	{
+		size_t length = strlen(str);
+
+		char *copy = static_cast<char*>(Allocate(length + 1));
+		memcpy(copy, str, length + 1);
+
+		return copy;
+	}
+
+	void Reset()
+	{
+		for(size_t i = finalizers.size(); i > 0; i--)
+			finalizers[i - 1].second(finalizers[i - 1].first);
+
+		finalizers.clear();
+
+		for(size_t i = 0; i < blocks.size(); i++)
+			free(blocks[i]);
+
+		blocks.clear();
+
+		current = NULL;
+		offset = 0;
+		size = 0;
+
+		allocationCount = 0;
+		allocationSize = 0;
+	}
+
+	unsigned BlockCount() const
+	{
+		return unsigned(blocks.size());
+	}
+
+	unsigned allocationCount;
+	size_t allocationSize;
+
+private:
+	typedef std::pair<void*, void (*)(void*)> Finalizer;
+
+	static const size_t BlockSize = 1 << 20;
+
+	template<typename T>
+	static void Destroy(void *object)
+	{
+		static_cast<T*>(object)->~T();
+	}
+
+	void NewBlock(size_t bytes)
+	{
+		size_t blockSize = bytes > BlockSize ? bytes : BlockSize;
+
+		// Same failure as the allocations the arena replaces
+		char *block = static_cast<char*>(malloc(blockSize));
+
+		if(!block)
+			throw std::bad_alloc();
+
+		blocks.push_back(block);
+
+		current = block;
+		size = blockSize;
+		offset = 0;
+	}
+
+	char *current;
+	size_t offset;
+	size_t size;
+
+	std::vector<char*> blocks;
+	std::vector<Finalizer> finalizers;
+};
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <vector>
+
+#include "kernels.h"
+#include "loader.h"
+
+void LogPrint(const char* format, ...);
+
+float RandomFloat(float min, float max)
+{
+	return min + (max - min) * float(rand()) / float(RAND_MAX);
+}
+
+void RandomMatrix(mat4 &m)
+{
+	m.identity();
+
+	float x = RandomFloat(-1.0f, 1.0f), y = RandomFloat(-1.0f, 1.0f), z = RandomFloat(0.1f, 1.0f);
+	float length = sqrtf(x * x + y * y + z * z);
+
+	m.rotate(vec3(x / length, y / length, z / length), RandomFloat(-180.0f, 180.0f));
+	m.translate(vec3(RandomFloat(-10.0f, 10.0f), RandomFloat(-10.0f, 10.0f), RandomFloat(-10.0f, 10.0f)));
+}
+
+float MaxDifference(const aabb &a, const aabb &b)
+{
+	float diff = 0.0f;
+
+	diff = fmaxf(diff, fabsf(a.center.x - b.center.x));
+	diff = fmaxf(diff, fabsf(a.center.y - b.center.y));
+	diff = fmaxf(diff, fabsf(a.center.z - b.center.z));
+	diff = fmaxf(diff, fabsf(a.size.x - b.size.x));
+	diff = fmaxf(diff, fabsf(a.size.y - b.size.y));
+	diff = fmaxf(diff, fabsf(a.size.z - b.size.z));
+
+	return diff;
+}
+
+// Compares batch kernels against the scalar bone bounds computation on random data
+void RunKernelBenchmark(unsigned boneCount, unsigned iterations)
+{
+	srand(0);
+
+	std::vector<mat4> world(boneCount), bind(boneCount);
+	std::vector<aabb> local(boneCount), scalarResult(boneCount), batchResult(boneCount);
+
+	MatrixBatch worldBatch, bindBatch, boneBatch;
+	BoundsBatch localBatch;
+
+	worldBatch.resize(boneCount);
+	bindBatch.resize(boneCount);
+	localBatch.resize(boneCount);
+
+	for(unsigned i = 0; i < boneCount; i++)
+	{
+		RandomMatrix(world[i]);
+		RandomMatrix(bind[i]);
+
+		local[i].center = vec3(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f));
+		local[i].size = vec3(RandomFloat(0.1f, 1.0f), RandomFloat(0.1f, 1.0f), RandomFloat(0.1f, 1.0f));
+
+		bindBatch.set(i, bind[i]);
+		localBatch.set(i, local[i]);
+	}
+
+	unsigned startTime = clock();
+
+	mat4 bone;
+
+	for(unsigned n = 0; n < iterations; n++)
+	{
+		for(unsigned i = 0; i < boneCount; i++)
+		{
+			mul(bone, world[i], bind[i]);
+
+			scalarResult[i] = local[i];
+			scalarResult[i].mul(bone);
+		}
+	}
+
+	unsigned scalarTime = clock() - startTime;
+
+	startTime = clock();
+
+	// World matrices are gathered every iteration, as they are in the frame cache
+	for(unsigned n = 0; n < iterations; n++)
+	{
+		for(unsigned i = 0; i < boneCount; i++)
+			worldBatch.set(i, world[i]);
+
+		BatchMul(boneBatch, worldBatch, bindBatch);
+		BatchTransformBounds(batchResult.data(), localBatch, boneBatch);
+	}
+
+	unsigned batchTime = clock() - startTime;
+
+	float diff = 0.0f;
+
+	for(unsigned i = 0; i < boneCount; i++)
+		diff = fmaxf(diff, MaxDifference(scalarResult[i], batchResult[i]));
+
+	LogPrint("Bone bounds of %d bones x %d iterations: scalar %dms, %s batch %dms, max difference %f\r\n", boneCount, iterations, scalarTime, BatchKernelName(), batchTime, diff);
+}
+
+// Measures how long it takes to get a geometry file ready for upload, run on version 1 and version 2 files of the same scene to compare them
+void RunGeometryLoadBenchmark(const char *path, unsigned iterations)
+{
+	GeometryFile file;
+
+	if(!OpenGeometry(path, file))
+		return;
+
+	unsigned version = file.info.version;
+	size_t size = size_t(file.info.vertexCount) * file.info.vertexSize + size_t(file.info.indexCount) * file.info.indexSize;
+
+	CloseGeometry(file);
+
+	unsigned startTime = clock();
+	unsigned checksum = 0;
+
+	for(unsigned n = 0; n < iterations; n++)
+	{
+		if(!OpenGeometry(path, file))
+			return;
+
+		// Touch every page, as an upload would
+		const unsigned char *vertices = (const unsigned char*)file.vertexData;
+		const unsigned char *indices = (const unsigned char*)file.indexData;
+
+		for(size_t i = 0; i < size_t(file.info.vertexCount) * file.info.vertexSize; i += 4096)
+			checksum += vertices[i];
+
+		for(size_t i = 0; i < size_t(file.info.indexCount) * file.info.indexSize; i += 4096)
+			checksum += indices[i];
+
+		CloseGeometry(file);
+	}
+
+	unsigned loadTime = clock() - startTime;
+
+	LogPrint("Geometry '%s' (version %d, %d KB of data) loaded %d times in %dms, %.3fms per load (checksum %d)\r\n", path, version, unsigned(size / 1024), iterations, loadTime, double(loadTime) / iterations, checksum);
+}
+
+// Measures the time from opening an object file to the first use of its nodes, controllers and materials, and the cost of evaluating a frame
+void RunObjectLoadBenchmark(const char *path, unsigned iterations)
+{
+	ObjectFile file;
+
+	if(!OpenObject(path, file))
+		return;
+
+	unsigned version = file.version;
+	unsigned nodeCount = file.nodeCount;
+	size_t fileSize = file.mapped.data ? file.mapped.size : file.bytesTouched;
+	size_t bytesTouched = file.bytesTouched;
+
+	CloseObject(file);
+
+	unsigned startTime = clock();
+	unsigned checksum = 0;
+
+	for(unsigned n = 0; n < iterations; n++)
+	{
+		if(!OpenObject(path, file))
+			return;
+
+		// First use is what a renderer needs to set up the object
+		for(unsigned i = 0; i < file.nodeCount; i++)
+		{
+			if(file.nodes[i].geometryNameOffset != 0)
+				checksum += file.strings[file.nodes[i].geometryNameOffset];
+		}
+
+		if(file.controllerCount && file.controllers[0].boneCount)
+			checksum += unsigned(file.boneBindMats[file.controllers[0].firstBone].mat[0]);
+
+		if(file.materialCount)
+			checksum += file.strings[file.materials[0].colorStringOffset];
+
+		CloseObject(file);
+	}
+
+	unsigned loadTime = clock() - startTime;
+
+	LogPrint("Object '%s' (version %d, %d nodes) opened %d times in %dms, %.3fms to first use, %d of %d KB touched (checksum %d)\r\n", path, version, nodeCount, iterations, loadTime, double(loadTime) / iterations, unsigned(bytesTouched / 1024), unsigned(fileSize / 1024), checksum);
+
+	if(!OpenObject(path, file))
+		return;
+
+	// Every frame of the animation is evaluated in turn
+	unsigned frameCount = file.animSampleCount ? file.animSampleCount : 1;
+	unsigned evaluationCount = frameCount * iterations;
+
+	ObjectPose pose;
+	pose.bytesTouched = 0;
+
+	startTime = clock();
+
+	for(unsigned n = 0; n < evaluationCount; n++)
+	{
+		EvaluateObject(file, n % frameCount, pose);
+
+		checksum += unsigned(pose.world.empty() ? 0.0f : pose.world.back().mat[12]);
+	}
+
+	unsigned evaluationTime = clock() - startTime;
+
+	LogPrint("Object '%s' evaluated %d times (%d frames, %d bones) in %dms, %.4fms per frame, %d bytes of animation read per frame (checksum %d)\r\n", path, evaluationCount, frameCount, file.boneCount, evaluationTime, double(evaluationTime) / evaluationCount, unsigned(pose.bytesTouched / evaluationCount), checksum);
+
+	CloseObject(file);
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "archive.h"
+#include "cache.h"
+#include "loader.h"
+#include "output.h"
+
+void LogPrint(const char* format, ...);
+
+uint64_t HashData(const void *data, size_t size, uint64_t hash)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+uint64_t ConversionKey(const char *data, size_t size, const char *sceneName, const ConvertOptions &options)
+{
+	uint64_t hash = HashData(data, size, 14695981039346656037ull);
+
+	// Outputs are restored under the names they were saved with, so a copy of the input under another name is a different conversion
+	hash = HashData(sceneName, strlen(sceneName) + 1, hash);
+
+	// Options are hashed one by one, so that structure padding doesn't affect the key
+	uint32_t version = ConverterVersion;
+	hash = HashData(&version, sizeof(version), hash);
+
+	hash = HashData(&options.animChunkDuration, sizeof(options.animChunkDuration), hash);
+	hash = HashData(&options.nameHashes, sizeof(options.nameHashes), hash);
+	hash = HashData(&options.geometryVersion, sizeof(options.geometryVersion), hash);
+	hash = HashData(&options.objectVersion, sizeof(options.objectVersion), hash);
+	hash = HashData(&options.pack, sizeof(options.pack), hash);
+
+	// Pooled geometry names don't depend on the pool folder
+	bool geometryPool = options.geometryPool != NULL;
+	hash = HashData(&geometryPool, sizeof(geometryPool), hash);
+
+	return hash;
+}
+
+void CacheFileName(char *buf, const ConversionCache &cache, uint64_t key)
+{
+	sprintf(buf, "%s/%016llx.bpk", cache.folder, (unsigned long long)key);
+}
+
+// Pooled geometry is stored under this prefix, so it can't clash with the outputs
+const char *PooledEntryPrefix = "pool/";
+
+bool RestoreCachedOutputs(ConversionCache &cache, uint64_t key, const char *folderNameOut, const char *geometryPool)
+{
+	char fileName[512];
+	CacheFileName(fileName, cache, key);
+
+	// Missing archive is a miss, not an error
+	FILE *fIn = fopen(fileName, "rb");
+
+	if(!fIn)
+	{
+		cache.misses++;
+		return false;
+	}
+
+	fclose(fIn);
+
+	ArchiveFile archive;
+
+	if(!OpenArchive(fileName, archive))
+	{
+		cache.misses++;
+		return false;
+	}
+
+	bool restored = true;
+	unsigned writtenCount = 0;
+	unsigned pooledCount = 0;
+
+	for(unsigned i = 0; i < archive.info.entryCount && restored; i++)
+	{
+		auto &entry = archive.entries[i];
+		const char *name = archive.names + entry.nameOffset;
+
+		char buf[512];
+
+		bool pooled = strncmp(name, PooledEntryPrefix, strlen(PooledEntryPrefix)) == 0;
+
+		if(pooled)
+		{
+			if(!geometryPool)
+			{
+				restored = false;
+				break;
+			}
+
+			// Geometry that is still in the pool is left untouched
+			sprintf(buf, "%s/%s", geometryPool, name + strlen(PooledEntryPrefix));
+
+			if(FILE *fPooled = fopen(buf, "rb"))
+			{
+				fclose(fPooled);
+				continue;
+			}
+		}
+		else
+		{
+			sprintf(buf, "%s/%s", folderNameOut, name);
+		}
+
+		restored = SaveOutputFile(buf, (const char*)archive.mapped.data + entry.offset, size_t(entry.size));
+
+		if(restored)
+		{
+			writtenCount++;
+			pooledCount += pooled;
+		}
+	}
+
+	if(restored)
+	{
+		LogPrint("Restored %d files from cache '%s'\r\n", writtenCount, fileName);
+
+		if(pooledCount)
+			LogPrint("%d pooled geometries were missing from the pool and were restored\r\n", pooledCount);
+	}
+	else
+	{
+		// Files that were restored before the failure stay in place, the conversion overwrites them
+		LogPrint("Abandoned cache '%s' after restoring %d files, the input is converted again and the restored files are left in place\r\n", fileName, writtenCount);
+	}
+
+	CloseArchive(archive);
+
+	if(restored)
+		cache.hits++;
+	else
+		cache.misses++;
+
+	return restored;
+}
+
+void StoreCachedOutputs(ConversionCache &cache, uint64_t key, const std::vector<std::string> &outputs, const std::vector<std::string> &pooled)
+{
+	char fileName[512];
+	CacheFileName(fileName, cache, key);
+
+	// Archive is completed under a temporary name, so that an interrupted conversion never leaves a damaged entry
+	char tempName[512];
+	sprintf(tempName, "%s.tmp", fileName);
+
+	ArchiveWriter archive;
+
+	if(!BeginArchive(archive, tempName))
+		return;
+
+	bool stored = true;
+
+	for(unsigned i = 0; i < outputs.size() && stored; i++)
+	{
+		const char *path = outputs[i].c_str();
+		const char *name = strrchr(path, '/');
+
+		FILE *fIn = fopen(path, "rb");
+
+		stored = fIn && AddArchiveFile(archive, name ? name + 1 : path, fIn, Export::MeshSectionAlignment);
+
+		if(fIn)
+			fclose(fIn);
+	}
+
+	for(unsigned i = 0; i < pooled.size() && stored; i++)
+	{
+		const char *path = pooled[i].c_str();
+		const char *name = strrchr(path, '/');
+
+		char entryName[512];
+		sprintf(entryName, "%s%s", PooledEntryPrefix, name ? name + 1 : path);
+
+		FILE *fIn = fopen(path, "rb");
+
+		stored = fIn && AddArchiveFile(archive, entryName, fIn, Export::MeshSectionAlignment);
+
+		if(fIn)
+			fclose(fIn);
+	}
+
+	stored &= EndArchive(archive);
+
+	if(!stored || !MoveOverFile(tempName, fileName))
+	{
+		LogPrint("Failed to store outputs in cache '%s'\r\n", fileName);
+
+		remove(tempName);
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+#include "context.h"
+
+// Has to be increased whenever the converter saves different files for the same input and options
+const uint32_t ConverterVersion = 2;
+
+// Outputs of earlier conversions, stored as one archive per conversion under the key of the conversion
+struct ConversionCache
+{
+	ConversionCache(): enabled(false), hits(0), misses(0)
+	{
+		folder[0] = 0;
+	}
+
+	bool enabled;
+	char folder[512];
+
+	unsigned hits;
+	unsigned misses;
+};
+
+// 64-bit FNV-1a of the data, continued from the hash of the previous data
+uint64_t HashData(const void *data, size_t size, uint64_t hash);
+
+// Key of a conversion is the hash of the input file contents, the scene file name, the options and the converter version
+uint64_t ConversionKey(const char *data, size_t size, const char *sceneName, const ConvertOptions &options);
+
+// Saves outputs of the conversion into the folder and pooled geometry missing from the pool, returns false if the conversion is not cached
+bool RestoreCachedOutputs(ConversionCache &cache, uint64_t key, const char *folderNameOut, const char *geometryPool);
+
+// Outputs are files saved by the conversion, they are restored into the output folder under the same names
+// Pooled geometry the outputs refer to is kept as well, since the pool may be cleaned or replaced before the restore
+void StoreCachedOutputs(ConversionCache &cache, uint64_t key, const std::vector<std::string> &outputs, const std::vector<std::string> &pooled);
@@ -3,6 +3,8 @@
 #include <cstdint>
 
 #include <array>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "../simplemath/aabb.h"
@@ -107,10 +109,25 @@ public:
 		std::fill(streamLink.begin(), streamLink.end(), ~0u);
 	}
 
-	void Free()
+	void FreeStreams()
 	{
 		for(int i = 0; i < MaxStreams; i++)
+		{
 			delete[] streams[i].data;
+			streams[i].data = nullptr;
+		}
+	}
+
+	void FreeIndices()
+	{
+		delete[] indices;
+		indices = nullptr;
+	}
+
+	void Free()
+	{
+		FreeStreams();
+		FreeIndices();
 	}
 
 	const char *ID;
@@ -154,6 +171,9 @@ struct DAETransform
 
 typedef DAETransform DAETransformBlock[8];
 
+// Animation sampling supports a limited number of transformation elements per node
+const uint32_t MaxNodeTransforms = 8u;
+
 struct DAENode
 {
 	DAENode()
@@ -162,6 +182,7 @@ struct DAENode
 		name = nullptr;
 		sid = nullptr;
 
+		firstTransform = 0;
 		tCount = 0;
 
 		geometryID = ~0u;
@@ -171,6 +192,7 @@ struct DAENode
 		effectID = ~0u;
 
 		childCount = 0;
+		subtreeEnd = 0;
 		isJoint = false;
 		isSkeletonRoot = false;
 	}
@@ -179,7 +201,7 @@ struct DAENode
 	const char *name;
 	const char *sid;
 
-	DAETransformBlock tForm;
+	uint32_t firstTransform; // Transformation elements are stored in the context transform pool
 	uint32_t tCount;
 	mat4 model;
 
@@ -190,6 +212,7 @@ struct DAENode
 	uint32_t effectID;
 
 	uint32_t childCount;
+	uint32_t subtreeEnd; // Nodes are in document order, so the subtree is [index, subtreeEnd)
 	bool isJoint;
 	bool isSkeletonRoot;
 };
@@ -200,6 +223,7 @@ struct DAESkeleton
 	{
 		controllerID = ~0u;
 
+		firstJoint = 0;
 		jointCount = 0;
 	}
 
@@ -207,9 +231,8 @@ struct DAESkeleton
 	uint32_t controllerID;
 
 	mat4 bindShapeMat;
+	uint32_t firstJoint; // Joint nodes and bind matrices are stored in the context joint pools
 	uint32_t jointCount;
-	std::array<uint32_t, 256> nodeIDs;
-	std::array<mat4, 256> bindMat;
 };
 
 enum Interpolation
@@ -231,6 +254,8 @@ struct DAESource
 
 		dataName = 0;
 
+		dataFloat = 0;
+
 		isConstant = false;
 
 		count = 0;
@@ -243,7 +268,7 @@ struct DAESource
 	
 	char **dataName;
 
-	std::vector<float> dataFloat;
+	float *dataFloat;
 
 	bool isConstant;
 
@@ -269,6 +294,7 @@ struct DAEAnimation
 	uint32_t targetNodePos;
 	uint32_t compOffset;
 
+	uint32_t targetPart;
 	uint32_t lastSample;
 };
 
@@ -328,19 +354,86 @@ struct DAEMaterial
 	unsigned effectID;
 };
 
+enum SymbolType
+{
+	SYM_IMAGE,
+	SYM_EFFECT,
+	SYM_MATERIAL,
+	SYM_GEOMETRY,
+	SYM_CONTROLLER,
+	SYM_NODE,
+
+	SYM_COUNT
+};
+
+// Document IDs mapped to indices of the loaded library elements
+struct SymbolTable
+{
+	void Clear()
+	{
+		for(unsigned i = 0; i < SYM_COUNT; i++)
+			symbols[i].clear();
+	}
+
+	// With duplicate IDs, 'replace' selects if the last declaration is used instead of the first one
+	void Add(SymbolType type, const char *ID, unsigned index, bool replace)
+	{
+		if(replace)
+			symbols[type][ID] = index;
+		else
+			symbols[type].insert(std::make_pair(std::string(ID), index));
+	}
+
+	unsigned Find(SymbolType type, const char *ID) const
+	{
+		auto it = symbols[type].find(ID);
+
+		return it != symbols[type].end() ? it->second : ~0u;
+	}
+
+	std::unordered_map<std::string, unsigned> symbols[SYM_COUNT];
+};
+
+struct ConvertOptions
+{
+	ConvertOptions()
+	{
+		animChunkDuration = 0.0;
+		nameHashes = false;
+		geometryVersion = 1;
+		objectVersion = 4;
+		pack = false;
+		geometryPool = NULL;
+	}
+
+	double animChunkDuration; // Split animation into chunks of the specified duration in seconds
+	bool nameHashes; // Save hashes of node, geometry and texture names
+	unsigned geometryVersion; // Version of the .bgi layout
+	unsigned objectVersion; // Version of the .bmi layout
+	bool pack; // Save all geometry and objects of a scene into one .bpk archive
+	const char *geometryPool; // Save geometry into this folder, named by a hash of its contents
+};
+
 struct Context
 {
-	Context(): geometryIDs(0), matrixAnimation(0)
+	Context(): animSampleCount(0), animSampleStep(0.0), geometryIDs(0), outputFailed(false)
 	{
 	}
 
+	ConvertOptions options;
+	SymbolTable symbols;
+
 	std::vector<DAEGeometry*> geoms;
 	std::vector<DAENode> nodes;
 	std::vector<DAESkeleton> skeletons;
 
+	std::vector<DAETransform> transforms;
+	std::vector<uint32_t> jointNodes;
+	std::vector<mat4> jointBindMat;
+
 	std::vector<unsigned> animatedNodes;
-	mat4 *matrixAnimation;
 	unsigned animSampleCount;
+	double animSampleStep;
 
 	std::vector<DAEController*> contrls;
 	const char **geometryIDs;
@@ -348,6 +441,10 @@ struct Context
 	std::vector<DAEImage> images;
 	std::vector<DAEEffect> effects;
 	std::vector<DAEMaterial> materials;
+
+	std::vector<std::string> outputFiles; // Files saved for the current input
+	std::vector<std::string> pooledFiles; // Pooled geometry referenced by the current input
+	bool outputFailed; // Some output of the current input was not saved
 };
 
 struct ContextLocal
@@ -356,7 +453,15 @@ struct ContextLocal
 	std::vector<DAESkeleton> skeletons;
 	std::vector<DAEEffect> effects;
 
+	std::vector<uint32_t> jointNodes;
+	std::vector<mat4> jointBindMat;
+
 	std::vector<unsigned> animatedNodes;
-	mat4 *matrixAnimation;
 	unsigned animSampleCount;
 };
+
+struct ExportTarget
+{
+	char fileName[512];
+	unsigned nodeID;
+};
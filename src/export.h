@@ -35,14 +35,50 @@ namespace Export
 
 		aabb bounds;
 
+		// Version 1:
 		// uint32_t vertexFormat[formatComponents];
 
 		// uint8_t vertexData[vertexCount][vertexSize];
 
 		// uint8_t indexData[indexCount][indexSize];
+
+		// Version 2, file can be mapped and its sections used in place:
+		// GeometryLayout layout;
+
+		// uint32_t vertexFormat[formatComponents];	// Padded to 16 bytes
+
+		// uint8_t vertexData[vertexCount][vertexSize];	// At layout.vertexDataOffset, padded to the page size
+		// uint8_t indexData[indexCount][indexSize];	// At layout.indexDataOffset, padded to the page size
+	};
+
+	const uint32_t GeometryPageSize = 4096;
+
+	struct GeometryLayout
+	{
+		uint32_t pageSize;	// Alignment of the data sections
+		uint32_t reserved;
+
+		uint64_t vertexDataOffset;	// Offset from the start of the file
+		uint64_t indexDataOffset;	// Offset from the start of the file
+		uint64_t fileSize;
 	};
 
 	// Object data file
+
+	// 64-bit FNV-1a hash of a name, used for names in object files saved with MF_NAME_HASHES
+	inline uint64_t NameHash(const char *str)
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		for(; *str; str++)
+		{
+			hash ^= (unsigned char)*str;
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
 	struct NodeInfo
 	{
 		uint32_t nameOffset; // Offset into the string data
@@ -53,6 +89,9 @@ namespace Export
 		uint32_t effectID;		// Reference to material information
 		uint32_t flags;
 
+		uint64_t nameHash;			// Zero without MF_NAME_HASHES
+		uint64_t geometryNameHash;	// Zero without MF_NAME_HASHES or geometry
+
 		mat4 model;			// Model matrix with parent transformations
 		mat4 modelOriginal;	// Model matrix without parent transformations
 	};
@@ -68,16 +107,51 @@ namespace Export
 		// aabb boneBounds[boneCount];
 	};
 
+	struct AnimTrackInfo
+	{
+		uint32_t firstKey;	// Index of the first key of the track
+		uint32_t keyCount;	// Number of keys in the track, at least 2
+	};
+
+	struct AnimChunkInfo
+	{
+		uint64_t offset;	// Offset of the chunk data from the start of the file
+		uint64_t size;		// Size of the chunk data
+
+		uint32_t firstFrame;
+		uint32_t frameCount;
+
+		aabb bounds;	// Bounds of all frames in the chunk
+
+		// AnimTrackInfo chunkTracks[animNodeCount];	// Track keys are indexed from the start of the chunk
+
+		// uint32_t chunkKeyCount;
+		// uint32_t chunkKeyFrames[chunkKeyCount];
+		// mat4 chunkKeys[chunkKeyCount];
+
+		// aabb chunkAabbState[frameCount];
+	};
+
 	struct MaterialInfo
 	{
 		uint32_t colorStringOffset; // Offset into the string data
 		uint32_t alphaStringOffset; // Offset into the string data
+
+		uint64_t colorHash;	// Zero without MF_NAME_HASHES or texture
+		uint64_t alphaHash;	// Zero without MF_NAME_HASHES or texture
+	};
+
+	enum MeshFlags
+	{
+		MF_CHUNKED_ANIMATION = 1 << 0,
+		MF_NAME_HASHES = 1 << 1,
 	};
 
 	struct MeshInfo
 	{
 		uint32_t header; // 0x57bedefe
 		uint32_t version;
+		uint32_t flags;
 
 		// uint32_t nodeCount;
 		// NodeInfo nodes[nodeCount];
@@ -89,18 +163,129 @@ namespace Export
 		// uint32_t animNodeIds[animNodeCount];
 
 		// uint32_t animSampleCount;
-		// mat4 animSamples[animSampleCount][animNodeCount];
+
+		// Without MF_CHUNKED_ANIMATION:
+		// AnimTrackInfo animTracks[animNodeCount];
+
+		// uint32_t animKeyCount;
+		// uint32_t animKeyFrames[animKeyCount];	// Frame at which the key starts, the key holds until the next key of the track
+		// mat4 animKeys[animKeyCount];
 
 		// aabb aabbState[animSampleCount ? animSampleCount : 1];
 
+		// With MF_CHUNKED_ANIMATION:
+		// uint32_t animChunkCount;
+		// AnimChunkInfo animChunks[animChunkCount];
+
+		// aabb bounds;	// Bounds of all frames
+
 		// uint32_t materialCount;
 		// MaterialInfo materials[materialCount];
 
 		// uint32_t stringDataSize;
-		// char stringData[stringDataSize];
+		// char stringData[stringDataSize];	// Every string is stored once, offset 0 is an empty string that also means "none"
+
+		// With MF_CHUNKED_ANIMATION, animation chunk data follows
 	};
 
+	// Object data file version 5, file can be mapped and its sections used in place:
+	// MeshInfo info;
+	// uint32_t padding;
+	// MeshLayout layout;
+
+	// Sections follow in the order of MeshSectionType, each one starts at a multiple of MeshSectionAlignment
+	// With MF_CHUNKED_ANIMATION, animation chunk data follows the sections, laid out as in version 4
+
+	enum MeshSectionType
+	{
+		MS_NODES,			// NodeInfo nodes[nodeCount]
+		MS_CONTROLLERS,		// ControllerLayout controllers[controllerCount]
+		MS_BONE_NODES,		// uint32_t nodeIDs[boneCount]
+		MS_BONE_BIND_MATS,	// mat4 invBindMats[boneCount]
+		MS_BONE_BOUNDS,		// aabb boneBounds[boneCount]
+		MS_ANIM_NODES,		// uint32_t animNodeIds[animNodeCount]
+		MS_ANIM_TRACKS,		// AnimTrackInfo animTracks[animNodeCount], empty with MF_CHUNKED_ANIMATION
+		MS_ANIM_KEY_FRAMES,	// uint32_t animKeyFrames[animKeyCount], empty with MF_CHUNKED_ANIMATION
+		MS_ANIM_KEYS,		// mat4 animKeys[animKeyCount], empty with MF_CHUNKED_ANIMATION
+		MS_AABB_STATE,		// aabb aabbState[animSampleCount ? animSampleCount : 1], empty with MF_CHUNKED_ANIMATION
+		MS_ANIM_CHUNKS,		// AnimChunkInfo animChunks[animChunkCount], empty without MF_CHUNKED_ANIMATION
+		MS_MATERIALS,		// MaterialInfo materials[materialCount]
+		MS_STRINGS,			// char stringData[stringDataSize]
+
+		MS_COUNT
+	};
+
+	const uint32_t MeshSectionAlignment = 16;
+
+	struct MeshSection
+	{
+		uint64_t offset;	// Offset from the start of the file
+		uint32_t count;		// Number of elements
+		uint32_t stride;	// Size of an element
+	};
+
+	struct ControllerLayout
+	{
+		uint32_t boneCount;
+		uint32_t firstBone;	// Index of the first bone in the bone sections
+
+		mat4 bindPose;
+	};
+
+	struct MeshLayout
+	{
+		uint32_t sectionCount;	// MS_COUNT
+		uint32_t animSampleCount;
+
+		aabb bounds;	// Bounds of all frames
+
+		uint64_t fileSize;
+
+		MeshSection sections[MS_COUNT];
+	};
+
+	// Animation tracks:
+	// - nodes that are not animated or have a constant animation are not listed, their modelOriginal holds the transformation
+	// - keys of a track are sorted by frame, the first key starts at frame 0
+	// - node transformation at frame N is the last key of the track with a frame less or equal to N
+	// - with MF_CHUNKED_ANIMATION, the chunk containing frame N has a key at its first frame for every track, so it can be read and played on its own
+
 	// To prepare transformations for rendering:
+	// - iterate over all animated nodes and replace modelOriginal with the key of the current frame
 	// - iterate over all nodes, multiply parent transform by modelOriginal
 	// - iterate over all nodes and find if a node references a controller, in which case, each bone transformation is the node transform multiplied by inverse bind matrix
+
+	// Archive file, holds all geometry and object files of a scene under their file names
+	struct ArchiveEntry
+	{
+		uint64_t nameHash;	// NameHash of the name
+		uint64_t offset;	// Offset of the file data from the start of the archive
+		uint64_t size;		// Size of the file data
+
+		uint32_t nameOffset;	// Offset into the name data
+		uint32_t reserved;
+	};
+
+	struct ArchiveInfo
+	{
+		uint32_t header; // 0x57bea5c1
+		uint32_t version;
+
+		uint32_t entryCount;
+		uint32_t bucketCount;	// Power of two
+
+		uint64_t tableOffset;	// Offset of the entry table from the start of the archive
+		uint64_t fileSize;
+
+		// File data, each file starts at a multiple of its alignment:
+		// - version 2 geometry at GeometryPageSize
+		// - everything else at MeshSectionAlignment
+
+		// At tableOffset:
+		// ArchiveEntry entries[entryCount];	// Sorted by bucket, the bucket of an entry is nameHash & (bucketCount - 1)
+		// uint32_t buckets[bucketCount + 1];	// Entries of bucket N are buckets[N] to buckets[N + 1] - 1
+
+		// uint32_t nameDataSize;
+		// char nameData[nameDataSize];
+	};
 }
@@ -0,0 +1,194 @@
+#include <math.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+
+#define KERNEL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+#define KERNEL_SSE
+#endif
+
+#if defined(KERNEL_AVX) || defined(KERNEL_SSE)
+#define KERNEL_SSE_INTEGER
+#endif
+
+#if defined(KERNEL_AVX)
+typedef __m256 vfloat;
+
+const unsigned KernelWidth = 8;
+
+inline vfloat vload(const float *ptr){ return _mm256_loadu_ps(ptr); }
+inline void vstore(float *ptr, vfloat v){ _mm256_storeu_ps(ptr, v); }
+inline vfloat vadd(vfloat a, vfloat b){ return _mm256_add_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b){ return _mm256_mul_ps(a, b); }
+inline vfloat vabs(vfloat a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+#elif defined(KERNEL_SSE)
+typedef __m128 vfloat;
+
+const unsigned KernelWidth = 4;
+
+inline vfloat vload(const float *ptr){ return _mm_loadu_ps(ptr); }
+inline void vstore(float *ptr, vfloat v){ _mm_storeu_ps(ptr, v); }
+inline vfloat vadd(vfloat a, vfloat b){ return _mm_add_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b){ return _mm_mul_ps(a, b); }
+inline vfloat vabs(vfloat a){ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#else
+typedef float vfloat;
+
+const unsigned KernelWidth = 1;
+
+inline vfloat vload(const float *ptr){ return *ptr; }
+inline void vstore(float *ptr, vfloat v){ *ptr = v; }
+inline vfloat vadd(vfloat a, vfloat b){ return a + b; }
+inline vfloat vmul(vfloat a, vfloat b){ return a * b; }
+inline vfloat vabs(vfloat a){ return fabsf(a); }
+#endif
+
+// Capacity is padded to the widest kernel, so that every kernel can process whole lanes
+const unsigned BatchAlignment = 8;
+
+void MatrixBatch::resize(unsigned newCount)
+{
+	count = newCount;
+	capacity = (newCount + BatchAlignment - 1) / BatchAlignment * BatchAlignment;
+
+	data.clear();
+	data.resize(capacity * 16, 0.0f);
+}
+
+void BoundsBatch::resize(unsigned newCount)
+{
+	count = newCount;
+	capacity = (newCount + BatchAlignment - 1) / BatchAlignment * BatchAlignment;
+
+	data.clear();
+	data.resize(capacity * 6, 0.0f);
+}
+
+const char* BatchKernelName()
+{
+#if defined(KERNEL_AVX)
+	return "AVX";
+#elif defined(KERNEL_SSE)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void BatchMul(MatrixBatch &result, const MatrixBatch &a, const MatrixBatch &b)
+{
+	if(result.count != a.count)
+		result.resize(a.count);
+
+	const float *aData = a.data.data();
+	const float *bData = b.data.data();
+	float *rData = result.data.data();
+
+	unsigned aStride = a.capacity;
+	unsigned bStride = b.capacity;
+	unsigned rStride = result.capacity;
+
+	for(unsigned i = 0; i < a.count; i += KernelWidth)
+	{
+		vfloat m[16];
+
+		for(unsigned k = 0; k < 16; k++)
+			m[k] = vload(aData + k * aStride + i);
+
+		// Same element order as mat4 multiplication, translation is in elements 12-14
+		for(unsigned c = 0; c < 4; c++)
+		{
+			vfloat b0 = vload(bData + (c * 4 + 0) * bStride + i);
+			vfloat b1 = vload(bData + (c * 4 + 1) * bStride + i);
+			vfloat b2 = vload(bData + (c * 4 + 2) * bStride + i);
+			vfloat b3 = vload(bData + (c * 4 + 3) * bStride + i);
+
+			for(unsigned r = 0; r < 4; r++)
+			{
+				vfloat sum = vadd(vadd(vmul(m[r], b0), vmul(m[4 + r], b1)), vadd(vmul(m[8 + r], b2), vmul(m[12 + r], b3)));
+
+				vstore(rData + (c * 4 + r) * rStride + i, sum);
+			}
+		}
+	}
+}
+
+void BatchTransformBounds(aabb *result, const BoundsBatch &bounds, const MatrixBatch &transforms)
+{
+	const float *bData = bounds.data.data();
+	const float *mData = transforms.data.data();
+
+	unsigned bStride = bounds.capacity;
+	unsigned mStride = transforms.capacity;
+
+	float temp[6][KernelWidth];
+
+	for(unsigned i = 0; i < bounds.count; i += KernelWidth)
+	{
+		vfloat cx = vload(bData + 0 * bStride + i);
+		vfloat cy = vload(bData + 1 * bStride + i);
+		vfloat cz = vload(bData + 2 * bStride + i);
+
+		vfloat sx = vload(bData + 3 * bStride + i);
+		vfloat sy = vload(bData + 4 * bStride + i);
+		vfloat sz = vload(bData + 5 * bStride + i);
+
+		for(unsigned r = 0; r < 3; r++)
+		{
+			vfloat m0 = vload(mData + (0 + r) * mStride + i);
+			vfloat m1 = vload(mData + (4 + r) * mStride + i);
+			vfloat m2 = vload(mData + (8 + r) * mStride + i);
+			vfloat m3 = vload(mData + (12 + r) * mStride + i);
+
+			// Center is transformed as a point, extents by the absolute values of the rotation part
+			vstore(temp[r], vadd(vadd(vmul(m0, cx), vmul(m1, cy)), vadd(vmul(m2, cz), m3)));
+			vstore(temp[3 + r], vadd(vadd(vmul(vabs(m0), sx), vmul(vabs(m1), sy)), vmul(vabs(m2), sz)));
+		}
+
+		for(unsigned k = 0; k < KernelWidth && i + k < bounds.count; k++)
+		{
+			aabb &target = result[i + k];
+
+			target.center.x = temp[0][k];
+			target.center.y = temp[1][k];
+			target.center.z = temp[2][k];
+
+			target.size.x = temp[3][k];
+			target.size.y = temp[4][k];
+			target.size.z = temp[5][k];
+		}
+	}
+}
+
+void InterleaveSkinnedVertices(unsigned char *target, const Vertex *vertices, const uint32_t *posIndex, unsigned count, const int16_t *weights, const uint8_t *indices)
+{
+	static_assert(sizeof(Vertex) == 24, "vertex layout is expected to be 24 bytes");
+
+	for(unsigned i = 0; i < count; i++, target += SkinnedVertexSize)
+	{
+		const unsigned char *vertex = (const unsigned char*)&vertices[i];
+
+		unsigned source = posIndex[i];
+
+#if defined(KERNEL_SSE_INTEGER)
+		__m128i head = _mm_loadu_si128((const __m128i*)vertex);
+		__m128i tail = _mm_loadl_epi64((const __m128i*)(vertex + 16));
+		__m128i weight = _mm_loadl_epi64((const __m128i*)(weights + source * 4));
+
+		_mm_storeu_si128((__m128i*)target, head);
+		_mm_storel_epi64((__m128i*)(target + 16), tail);
+		_mm_storel_epi64((__m128i*)(target + 24), weight);
+#else
+		memcpy(target, vertex, sizeof(Vertex));
+		memcpy(target + 24, weights + source * 4, 8);
+#endif
+
+		memcpy(target + 32, indices + source * 4, 4);
+	}
+}
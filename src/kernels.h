@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vector>
+
+#include "../simplemath/aabb.h"
+
+#include "context.h"
+
+// Matrices stored as a structure of arrays, element k of matrix i is at data[k * capacity + i]
+struct MatrixBatch
+{
+	MatrixBatch(): count(0), capacity(0)
+	{
+	}
+
+	void resize(unsigned newCount);
+
+	void set(unsigned i, const mat4 &m)
+	{
+		for(unsigned k = 0; k < 16; k++)
+			data[k * capacity + i] = m.mat[k];
+	}
+
+	void get(unsigned i, mat4 &m) const
+	{
+		for(unsigned k = 0; k < 16; k++)
+			m.mat[k] = data[k * capacity + i];
+	}
+
+	std::vector<float> data;
+
+	unsigned count;
+	unsigned capacity;
+};
+
+// Bounding boxes stored as a structure of arrays
+struct BoundsBatch
+{
+	BoundsBatch(): count(0), capacity(0)
+	{
+	}
+
+	void resize(unsigned newCount);
+
+	void set(unsigned i, const aabb &bounds)
+	{
+		data[0 * capacity + i] = bounds.center.x;
+		data[1 * capacity + i] = bounds.center.y;
+		data[2 * capacity + i] = bounds.center.z;
+
+		data[3 * capacity + i] = bounds.size.x;
+		data[4 * capacity + i] = bounds.size.y;
+		data[5 * capacity + i] = bounds.size.z;
+	}
+
+	std::vector<float> data;
+
+	unsigned count;
+	unsigned capacity;
+};
+
+// Name of the instruction set used by the batch kernels
+const char* BatchKernelName();
+
+// result[i] = a[i] * b[i]
+void BatchMul(MatrixBatch &result, const MatrixBatch &a, const MatrixBatch &b);
+
+// result[i] = bounds[i] transformed by transforms[i]
+void BatchTransformBounds(aabb *result, const BoundsBatch &bounds, const MatrixBatch &transforms);
+
+// Size of a skinned vertex: vertex, 4 bone weights and 4 bone indices
+const unsigned SkinnedVertexSize = sizeof(Vertex) + 8 + 4;
+
+// Writes skinned vertices, weights and indices are taken from the source position of each vertex
+void InterleaveSkinnedVertices(unsigned char *target, const Vertex *vertices, const uint32_t *posIndex, unsigned count, const int16_t *weights, const uint8_t *indices);
@@ -0,0 +1,978 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "loader.h"
+
+void LogPrint(const char* format, ...);
+
+void* AllocateAligned(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void *ptr = NULL;
+
+	return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+#endif
+}
+
+void FreeAligned(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+bool MapFile(const char *path, MappedFile &file)
+{
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if(handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+
+	if(!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if(!mapping)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if(!view)
+	{
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.fileHandle = handle;
+	file.mappingHandle = mapping;
+	file.data = view;
+	file.size = size_t(size.QuadPart);
+#else
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0)
+		return false;
+
+	struct stat info;
+
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void *view = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if(view == MAP_FAILED)
+		return false;
+
+	file.data = view;
+	file.size = size_t(info.st_size);
+#endif
+
+	return true;
+}
+
+void UnmapFile(MappedFile &file)
+{
+	if(!file.data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mappingHandle);
+	CloseHandle(file.fileHandle);
+#else
+	munmap(file.data, file.size);
+#endif
+
+	file.data = NULL;
+	file.size = 0;
+}
+
+// Reads the whole file into memory allocated with malloc
+unsigned char* ReadWholeFile(const char *path, size_t &size)
+{
+	FILE *fIn = fopen(path, "rb");
+
+	if(!fIn)
+		return NULL;
+
+	fseek(fIn, 0, SEEK_END);
+	long length = ftell(fIn);
+	fseek(fIn, 0, SEEK_SET);
+
+	unsigned char *data = length > 0 ? (unsigned char*)malloc(size_t(length)) : NULL;
+
+	if(data && fread(data, 1, size_t(length), fIn) != size_t(length))
+	{
+		free(data);
+		data = NULL;
+	}
+
+	fclose(fIn);
+
+	size = data ? size_t(length) : 0;
+
+	return data;
+}
+
+bool ReadGeometryV1(const unsigned char *data, size_t size, GeometryFile &file)
+{
+	size_t formatSize = file.info.formatComponents * sizeof(uint32_t);
+	size_t vertexSize = size_t(file.info.vertexCount) * file.info.vertexSize;
+	size_t indexSize = size_t(file.info.indexCount) * file.info.indexSize;
+
+	size_t vertexOffset = sizeof(Export::GeometryInfo) + formatSize;
+
+	if(vertexOffset + vertexSize + indexSize > size)
+		return false;
+
+	// Sections are copied to aligned memory, as they would be for an upload
+	size_t stagingVertexSize = (vertexSize + 15) / 16 * 16;
+	size_t stagingIndexSize = (indexSize + 15) / 16 * 16;
+
+	unsigned char *staging = (unsigned char*)AllocateAligned(stagingVertexSize + stagingIndexSize + formatSize, Export::GeometryPageSize);
+
+	if(!staging)
+		return false;
+
+	memcpy(staging, data + vertexOffset, vertexSize);
+	memcpy(staging + stagingVertexSize, data + vertexOffset + vertexSize, indexSize);
+	memcpy(staging + stagingVertexSize + stagingIndexSize, data + sizeof(Export::GeometryInfo), formatSize);
+
+	file.staging = staging;
+	file.vertexData = staging;
+	file.indexData = staging + stagingVertexSize;
+	file.format = (const uint32_t*)(staging + stagingVertexSize + stagingIndexSize);
+
+	return true;
+}
+
+bool ReadGeometryV2(const unsigned char *data, size_t size, GeometryFile &file)
+{
+	if(size < sizeof(Export::GeometryInfo) + sizeof(Export::GeometryLayout))
+		return false;
+
+	Export::GeometryLayout layout;
+	memcpy(&layout, data + sizeof(Export::GeometryInfo), sizeof(layout));
+
+	size_t vertexSize = size_t(file.info.vertexCount) * file.info.vertexSize;
+	size_t indexSize = size_t(file.info.indexCount) * file.info.indexSize;
+
+	size_t formatEnd = sizeof(Export::GeometryInfo) + sizeof(Export::GeometryLayout) + file.info.formatComponents * sizeof(uint32_t);
+
+	if(layout.fileSize != size || formatEnd > layout.vertexDataOffset || layout.vertexDataOffset + vertexSize > layout.indexDataOffset || layout.indexDataOffset + indexSize > size)
+		return false;
+
+	if(layout.pageSize == 0 || layout.vertexDataOffset % layout.pageSize != 0 || layout.indexDataOffset % layout.pageSize != 0)
+		return false;
+
+	file.format = (const uint32_t*)(data + sizeof(Export::GeometryInfo) + sizeof(Export::GeometryLayout));
+	file.vertexData = data + layout.vertexDataOffset;
+	file.indexData = data + layout.indexDataOffset;
+
+	return true;
+}
+
+bool ReadGeometry(const unsigned char *data, size_t size, GeometryFile &file)
+{
+	if(size < sizeof(Export::GeometryInfo))
+		return false;
+
+	memcpy(&file.info, data, sizeof(Export::GeometryInfo));
+
+	if(file.info.version == 1)
+		return ReadGeometryV1(data, size, file);
+	else if(file.info.version == 2)
+		return ReadGeometryV2(data, size, file);
+
+	return false;
+}
+
+bool OpenGeometry(const char *path, GeometryFile &file)
+{
+	memset(&file, 0, sizeof(file));
+
+	FILE *fIn = fopen(path, "rb");
+
+	if(!fIn)
+	{
+		LogPrint("Geometry file '%s' not found\r\n", path);
+		return false;
+	}
+
+	bool header = fread(&file.info, sizeof(file.info), 1, fIn) == 1;
+
+	fclose(fIn);
+
+	bool loaded = false;
+
+	// Version 2 is mapped, version 1 is read and copied
+	if(header && file.info.version == 2)
+	{
+		loaded = MapFile(path, file.mapped) && ReadGeometry((const unsigned char*)file.mapped.data, file.mapped.size, file);
+	}
+	else if(header)
+	{
+		size_t size = 0;
+		unsigned char *data = ReadWholeFile(path, size);
+
+		loaded = data && ReadGeometry(data, size, file);
+
+		free(data);
+	}
+
+	if(!loaded)
+	{
+		LogPrint("Geometry file '%s' is damaged or has an unknown version\r\n", path);
+
+		CloseGeometry(file);
+		return false;
+	}
+
+	return true;
+}
+
+bool OpenGeometry(const void *data, size_t size, GeometryFile &file)
+{
+	memset(&file, 0, sizeof(file));
+
+	if(!ReadGeometry((const unsigned char*)data, size, file))
+	{
+		CloseGeometry(file);
+		return false;
+	}
+
+	return true;
+}
+
+void CloseGeometry(GeometryFile &file)
+{
+	UnmapFile(file.mapped);
+
+	if(file.staging)
+		FreeAligned(file.staging);
+
+	file.staging = NULL;
+}
+
+const uint32_t ObjectSectionStride[Export::MS_COUNT] =
+{
+	sizeof(Export::NodeInfo),
+	sizeof(Export::ControllerLayout),
+	sizeof(uint32_t),
+	sizeof(mat4),
+	sizeof(aabb),
+	sizeof(uint32_t),
+	sizeof(Export::AnimTrackInfo),
+	sizeof(uint32_t),
+	sizeof(mat4),
+	sizeof(aabb),
+	sizeof(Export::AnimChunkInfo),
+	sizeof(Export::MaterialInfo),
+	1,
+};
+
+size_t AlignObjectOffset(size_t offset)
+{
+	return (offset + Export::MeshSectionAlignment - 1) & ~size_t(Export::MeshSectionAlignment - 1);
+}
+
+void SetObjectSections(ObjectFile &file, const unsigned char *base, const Export::MeshSection *sections)
+{
+	file.nodes = (const Export::NodeInfo*)(base + sections[Export::MS_NODES].offset);
+	file.nodeCount = sections[Export::MS_NODES].count;
+
+	file.controllers = (const Export::ControllerLayout*)(base + sections[Export::MS_CONTROLLERS].offset);
+	file.controllerCount = sections[Export::MS_CONTROLLERS].count;
+
+	file.boneNodes = (const uint32_t*)(base + sections[Export::MS_BONE_NODES].offset);
+	file.boneBindMats = (const mat4*)(base + sections[Export::MS_BONE_BIND_MATS].offset);
+	file.boneBounds = (const aabb*)(base + sections[Export::MS_BONE_BOUNDS].offset);
+	file.boneCount = sections[Export::MS_BONE_NODES].count;
+
+	file.animNodes = (const uint32_t*)(base + sections[Export::MS_ANIM_NODES].offset);
+	file.animNodeCount = sections[Export::MS_ANIM_NODES].count;
+
+	file.animTracks = (const Export::AnimTrackInfo*)(base + sections[Export::MS_ANIM_TRACKS].offset);
+
+	file.animKeyFrames = (const uint32_t*)(base + sections[Export::MS_ANIM_KEY_FRAMES].offset);
+	file.animKeys = (const mat4*)(base + sections[Export::MS_ANIM_KEYS].offset);
+	file.animKeyCount = sections[Export::MS_ANIM_KEYS].count;
+
+	file.aabbState = (const aabb*)(base + sections[Export::MS_AABB_STATE].offset);
+	file.aabbStateCount = sections[Export::MS_AABB_STATE].count;
+
+	file.animChunks = (const Export::AnimChunkInfo*)(base + sections[Export::MS_ANIM_CHUNKS].offset);
+	file.animChunkCount = sections[Export::MS_ANIM_CHUNKS].count;
+
+	file.materials = (const Export::MaterialInfo*)(base + sections[Export::MS_MATERIALS].offset);
+	file.materialCount = sections[Export::MS_MATERIALS].count;
+
+	file.strings = (const char*)(base + sections[Export::MS_STRINGS].offset);
+	file.stringSize = sections[Export::MS_STRINGS].count;
+}
+
+// References between the sections are checked once, so that the data can be used without further checks
+bool ValidateObject(const ObjectFile &file, const Export::MeshSection *sections, size_t chunkDataSize)
+{
+	if(sections[Export::MS_BONE_BIND_MATS].count != file.boneCount || sections[Export::MS_BONE_BOUNDS].count != file.boneCount)
+		return false;
+
+	if(sections[Export::MS_ANIM_KEY_FRAMES].count != file.animKeyCount)
+		return false;
+
+	if(file.stringSize == 0 || file.strings[file.stringSize - 1] != 0)
+		return false;
+
+	for(unsigned i = 0; i < file.nodeCount; i++)
+	{
+		auto &node = file.nodes[i];
+
+		if(node.nameOffset >= file.stringSize || node.geometryNameOffset >= file.stringSize)
+			return false;
+
+		// Parents precede their children, so that transformations are computed in one pass
+		if(node.parentID != ~0u && node.parentID >= i)
+			return false;
+
+		if(node.controllerID != ~0u && node.controllerID >= file.controllerCount)
+			return false;
+
+		if(node.effectID != ~0u && node.effectID >= file.materialCount)
+			return false;
+	}
+
+	for(unsigned i = 0; i < file.controllerCount; i++)
+	{
+		if(uint64_t(file.controllers[i].firstBone) + file.controllers[i].boneCount > file.boneCount)
+			return false;
+	}
+
+	// Joints that are not part of the object are saved as ~0u
+	for(unsigned i = 0; i < file.boneCount; i++)
+	{
+		if(file.boneNodes[i] != ~0u && file.boneNodes[i] >= file.nodeCount)
+			return false;
+	}
+
+	for(unsigned i = 0; i < file.animNodeCount; i++)
+	{
+		if(file.animNodes[i] >= file.nodeCount)
+			return false;
+	}
+
+	if(file.flags & Export::MF_CHUNKED_ANIMATION)
+	{
+		for(unsigned i = 0; i < file.animChunkCount; i++)
+		{
+			auto &chunk = file.animChunks[i];
+
+			if(chunk.offset > chunkDataSize || chunk.size > chunkDataSize - chunk.offset)
+				return false;
+
+			// Version 4 chunks follow the string data unpadded
+			if(file.version == 5 && chunk.offset % 4 != 0)
+				return false;
+
+			if(uint64_t(chunk.firstFrame) + chunk.frameCount > file.animSampleCount)
+				return false;
+
+			// Chunk holds a track for every animated node, then keys and frame bounds
+			size_t tracksSize = file.animNodeCount * sizeof(Export::AnimTrackInfo);
+
+			if(chunk.size < tracksSize + 4)
+				return false;
+
+			const unsigned char *chunkData = file.chunkData + chunk.offset;
+
+			uint32_t keyCount;
+			memcpy(&keyCount, chunkData + tracksSize, 4);
+
+			if((chunk.size - tracksSize - 4) / (4 + sizeof(mat4)) < keyCount || chunk.size != tracksSize + 4 + keyCount * (4 + sizeof(mat4)) + chunk.frameCount * sizeof(aabb))
+				return false;
+
+			for(unsigned k = 0; k < file.animNodeCount; k++)
+			{
+				Export::AnimTrackInfo track;
+				memcpy(&track, chunkData + k * sizeof(track), sizeof(track));
+
+				if(track.keyCount == 0 || uint64_t(track.firstKey) + track.keyCount > keyCount)
+					return false;
+			}
+		}
+	}
+	else
+	{
+		if(sections[Export::MS_ANIM_TRACKS].count != file.animNodeCount)
+			return false;
+
+		if(file.aabbStateCount != (file.animSampleCount ? file.animSampleCount : 1))
+			return false;
+
+		for(unsigned i = 0; i < file.animNodeCount; i++)
+		{
+			if(file.animTracks[i].keyCount == 0 || uint64_t(file.animTracks[i].firstKey) + file.animTracks[i].keyCount > file.animKeyCount)
+				return false;
+		}
+	}
+
+	for(unsigned i = 0; i < file.materialCount; i++)
+	{
+		if(file.materials[i].colorStringOffset >= file.stringSize || file.materials[i].alphaStringOffset >= file.stringSize)
+			return false;
+	}
+
+	return true;
+}
+
+bool ReadObjectV5(const unsigned char *data, size_t size, ObjectFile &file)
+{
+	size_t layoutPos = AlignObjectOffset(sizeof(Export::MeshInfo));
+
+	if(size < layoutPos + sizeof(Export::MeshLayout))
+		return false;
+
+	const Export::MeshLayout *layout = (const Export::MeshLayout*)(data + layoutPos);
+
+	if(layout->sectionCount != Export::MS_COUNT || layout->fileSize != size)
+		return false;
+
+	for(unsigned i = 0; i < Export::MS_COUNT; i++)
+	{
+		auto &section = layout->sections[i];
+
+		if(section.stride != ObjectSectionStride[i] || section.offset % Export::MeshSectionAlignment != 0)
+			return false;
+
+		if(section.offset > size || uint64_t(section.count) * section.stride > size - section.offset)
+			return false;
+	}
+
+	file.animSampleCount = layout->animSampleCount;
+	file.bounds = layout->bounds;
+
+	SetObjectSections(file, data, layout->sections);
+
+	file.chunkData = data;
+
+	// Only the sections that are validated are read
+	file.bytesTouched = layoutPos + sizeof(Export::MeshLayout);
+
+	for(unsigned i = Export::MS_NODES; i <= Export::MS_MATERIALS; i++)
+	{
+		if(i != Export::MS_BONE_BIND_MATS && i != Export::MS_BONE_BOUNDS && i != Export::MS_ANIM_KEY_FRAMES && i != Export::MS_ANIM_KEYS && i != Export::MS_AABB_STATE)
+			file.bytesTouched += size_t(layout->sections[i].count) * layout->sections[i].stride;
+	}
+
+	return ValidateObject(file, layout->sections, size);
+}
+
+struct ReadCursor
+{
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+};
+
+bool ReadValue(ReadCursor &cursor, void *value, size_t size)
+{
+	if(cursor.size - cursor.pos < size)
+		return false;
+
+	memcpy(value, cursor.data + cursor.pos, size);
+	cursor.pos += size;
+
+	return true;
+}
+
+// Remembers where the array is and moves past it
+bool ReadArray(ReadCursor &cursor, uint32_t count, uint32_t stride, Export::MeshSection &section)
+{
+	if(uint64_t(count) * stride > cursor.size - cursor.pos)
+		return false;
+
+	section.offset = cursor.pos;
+	section.count = count;
+	section.stride = stride;
+
+	cursor.pos += size_t(count) * stride;
+
+	return true;
+}
+
+bool ReadObjectV4(const unsigned char *data, size_t size, ObjectFile &file)
+{
+	// Every section is found by walking the ones before it
+	ReadCursor cursor = { data, size, sizeof(Export::MeshInfo) };
+
+	Export::MeshSection source[Export::MS_COUNT];
+	memset(source, 0, sizeof(source));
+
+	uint32_t count = 0;
+
+	if(!ReadValue(cursor, &count, 4) || !ReadArray(cursor, count, sizeof(Export::NodeInfo), source[Export::MS_NODES]))
+		return false;
+
+	uint32_t controllerCount = 0;
+
+	if(!ReadValue(cursor, &controllerCount, 4))
+		return false;
+
+	std::vector<size_t> controllerPos(controllerCount);
+
+	uint32_t boneCount = 0;
+
+	for(unsigned i = 0; i < controllerCount; i++)
+	{
+		Export::ControllerInfo info;
+		Export::MeshSection bones;
+
+		controllerPos[i] = cursor.pos;
+
+		if(!ReadValue(cursor, &info, sizeof(info)) || !ReadArray(cursor, info.boneCount, 4 + sizeof(mat4) + sizeof(aabb), bones))
+			return false;
+
+		boneCount += info.boneCount;
+	}
+
+	source[Export::MS_CONTROLLERS].count = controllerCount;
+	source[Export::MS_BONE_NODES].count = boneCount;
+	source[Export::MS_BONE_BIND_MATS].count = boneCount;
+	source[Export::MS_BONE_BOUNDS].count = boneCount;
+
+	uint32_t animNodeCount = 0;
+
+	if(!ReadValue(cursor, &animNodeCount, 4) || !ReadArray(cursor, animNodeCount, 4, source[Export::MS_ANIM_NODES]))
+		return false;
+
+	if(!ReadValue(cursor, &file.animSampleCount, 4))
+		return false;
+
+	if(file.flags & Export::MF_CHUNKED_ANIMATION)
+	{
+		if(!ReadValue(cursor, &count, 4) || !ReadArray(cursor, count, sizeof(Export::AnimChunkInfo), source[Export::MS_ANIM_CHUNKS]))
+			return false;
+
+		if(!ReadValue(cursor, &file.bounds, sizeof(aabb)))
+			return false;
+	}
+	else
+	{
+		if(!ReadArray(cursor, animNodeCount, sizeof(Export::AnimTrackInfo), source[Export::MS_ANIM_TRACKS]))
+			return false;
+
+		if(!ReadValue(cursor, &count, 4) || !ReadArray(cursor, count, 4, source[Export::MS_ANIM_KEY_FRAMES]) || !ReadArray(cursor, count, sizeof(mat4), source[Export::MS_ANIM_KEYS]))
+			return false;
+
+		if(!ReadArray(cursor, file.animSampleCount ? file.animSampleCount : 1, sizeof(aabb), source[Export::MS_AABB_STATE]))
+			return false;
+	}
+
+	if(!ReadValue(cursor, &count, 4) || !ReadArray(cursor, count, sizeof(Export::MaterialInfo), source[Export::MS_MATERIALS]))
+		return false;
+
+	if(!ReadValue(cursor, &count, 4) || !ReadArray(cursor, count, 1, source[Export::MS_STRINGS]))
+		return false;
+
+	// Sections are copied to aligned memory in the version 5 order
+	Export::MeshSection sections[Export::MS_COUNT];
+
+	size_t offset = 0;
+
+	for(unsigned i = 0; i < Export::MS_COUNT; i++)
+	{
+		offset = AlignObjectOffset(offset);
+
+		sections[i].offset = offset;
+		sections[i].count = source[i].count;
+		sections[i].stride = ObjectSectionStride[i];
+
+		offset += size_t(sections[i].count) * sections[i].stride;
+	}
+
+	unsigned char *staging = (unsigned char*)AllocateAligned(offset ? offset : Export::MeshSectionAlignment, Export::MeshSectionAlignment);
+
+	if(!staging)
+		return false;
+
+	file.staging = staging;
+
+	for(unsigned i = 0; i < Export::MS_COUNT; i++)
+	{
+		if(i == Export::MS_CONTROLLERS || i == Export::MS_BONE_NODES || i == Export::MS_BONE_BIND_MATS || i == Export::MS_BONE_BOUNDS)
+			continue;
+
+		memcpy(staging + sections[i].offset, data + source[i].offset, size_t(sections[i].count) * sections[i].stride);
+	}
+
+	// Bones of every controller follow it in the file
+	Export::ControllerLayout *controllers = (Export::ControllerLayout*)(staging + sections[Export::MS_CONTROLLERS].offset);
+
+	uint32_t firstBone = 0;
+
+	for(unsigned i = 0; i < controllerCount; i++)
+	{
+		Export::ControllerInfo info;
+		memcpy(&info, data + controllerPos[i], sizeof(info));
+
+		controllers[i].boneCount = info.boneCount;
+		controllers[i].firstBone = firstBone;
+		controllers[i].bindPose = info.bindPose;
+
+		const unsigned char *bones = data + controllerPos[i] + sizeof(info);
+
+		memcpy(staging + sections[Export::MS_BONE_NODES].offset + 4 * firstBone, bones, 4 * info.boneCount);
+		bones += 4 * info.boneCount;
+
+		memcpy(staging + sections[Export::MS_BONE_BIND_MATS].offset + sizeof(mat4) * firstBone, bones, sizeof(mat4) * info.boneCount);
+		bones += sizeof(mat4) * info.boneCount;
+
+		memcpy(staging + sections[Export::MS_BONE_BOUNDS].offset + sizeof(aabb) * firstBone, bones, sizeof(aabb) * info.boneCount);
+
+		firstBone += info.boneCount;
+	}
+
+	SetObjectSections(file, staging, sections);
+
+	file.chunkData = data;
+
+	if(!(file.flags & Export::MF_CHUNKED_ANIMATION))
+	{
+		file.bounds = file.aabbState[0];
+
+		for(unsigned i = 1; i < file.aabbStateCount; i++)
+			file.bounds.merge(file.aabbState[i]);
+	}
+
+	file.bytesTouched = size;
+
+	return ValidateObject(file, sections, size);
+}
+
+bool ReadObject(const unsigned char *data, size_t size, ObjectFile &file)
+{
+	Export::MeshInfo info;
+
+	if(size < sizeof(info))
+		return false;
+
+	memcpy(&info, data, sizeof(info));
+
+	if(info.header != 0x57bedefe)
+		return false;
+
+	file.version = info.version;
+	file.flags = info.flags;
+
+	if(file.version == 4)
+		return ReadObjectV4(data, size, file);
+	else if(file.version == 5)
+		return ReadObjectV5(data, size, file);
+
+	return false;
+}
+
+bool OpenObject(const char *path, ObjectFile &file)
+{
+	memset(&file, 0, sizeof(file));
+
+	FILE *fIn = fopen(path, "rb");
+
+	if(!fIn)
+	{
+		LogPrint("Object file '%s' not found\r\n", path);
+		return false;
+	}
+
+	Export::MeshInfo info;
+
+	bool header = fread(&info, sizeof(info), 1, fIn) == 1;
+
+	fclose(fIn);
+
+	bool loaded = false;
+
+	// Version 5 is mapped, version 4 is read and kept for the animation chunks
+	if(header && info.version == 5)
+	{
+		loaded = MapFile(path, file.mapped) && ReadObject((const unsigned char*)file.mapped.data, file.mapped.size, file);
+	}
+	else if(header)
+	{
+		size_t size = 0;
+		unsigned char *data = ReadWholeFile(path, size);
+
+		file.buffer = data;
+
+		loaded = data && ReadObject(data, size, file);
+	}
+
+	if(!loaded)
+	{
+		LogPrint("Object file '%s' is damaged or has an unknown version\r\n", path);
+
+		CloseObject(file);
+		return false;
+	}
+
+	return true;
+}
+
+bool OpenObject(const void *data, size_t size, ObjectFile &file)
+{
+	memset(&file, 0, sizeof(file));
+
+	if(!ReadObject((const unsigned char*)data, size, file))
+	{
+		CloseObject(file);
+		return false;
+	}
+
+	return true;
+}
+
+void CloseObject(ObjectFile &file)
+{
+	UnmapFile(file.mapped);
+
+	if(file.staging)
+		FreeAligned(file.staging);
+
+	free(file.buffer);
+
+	file.staging = NULL;
+	file.buffer = NULL;
+}
+
+bool OpenArchive(const char *path, ArchiveFile &file)
+{
+	memset(&file, 0, sizeof(file));
+
+	bool loaded = MapFile(path, file.mapped);
+
+	const unsigned char *data = (const unsigned char*)file.mapped.data;
+	size_t size = file.mapped.size;
+
+	if(loaded)
+	{
+		loaded = size >= sizeof(Export::ArchiveInfo);
+
+		if(loaded)
+			memcpy(&file.info, data, sizeof(Export::ArchiveInfo));
+
+		loaded = loaded && file.info.header == 0x57bea5c1 && file.info.version == 1 && file.info.fileSize == size;
+		loaded = loaded && file.info.bucketCount != 0 && (file.info.bucketCount & (file.info.bucketCount - 1)) == 0;
+		loaded = loaded && file.info.tableOffset % Export::MeshSectionAlignment == 0;
+	}
+
+	// Entry table, buckets and the size of the name data
+	uint64_t tableSize = uint64_t(file.info.entryCount) * sizeof(Export::ArchiveEntry) + 4ull * (file.info.bucketCount + 1) + 4;
+
+	if(loaded)
+	{
+		loaded = file.info.tableOffset <= size && tableSize <= size - file.info.tableOffset;
+	}
+
+	if(loaded)
+	{
+		file.entries = (const Export::ArchiveEntry*)(data + file.info.tableOffset);
+		file.buckets = (const uint32_t*)(file.entries + file.info.entryCount);
+
+		memcpy(&file.nameDataSize, file.buckets + file.info.bucketCount + 1, 4);
+
+		file.names = (const char*)(file.buckets + file.info.bucketCount + 1) + 4;
+
+		loaded = file.nameDataSize != 0 && file.nameDataSize <= size - file.info.tableOffset - tableSize && file.names[file.nameDataSize - 1] == 0;
+	}
+
+	if(loaded)
+	{
+		loaded = file.buckets[0] == 0 && file.buckets[file.info.bucketCount] == file.info.entryCount;
+
+		for(unsigned i = 0; loaded && i < file.info.bucketCount; i++)
+			loaded = file.buckets[i] <= file.buckets[i + 1];
+	}
+
+	for(unsigned i = 0; loaded && i < file.info.entryCount; i++)
+	{
+		auto &entry = file.entries[i];
+
+		loaded = entry.offset <= file.info.tableOffset && entry.size <= file.info.tableOffset - entry.offset && entry.nameOffset < file.nameDataSize;
+	}
+
+	if(!loaded)
+	{
+		LogPrint("Archive '%s' not found or damaged\r\n", path);
+
+		CloseArchive(file);
+		return false;
+	}
+
+	return true;
+}
+
+void CloseArchive(ArchiveFile &file)
+{
+	UnmapFile(file.mapped);
+}
+
+const void* FindArchiveEntry(const ArchiveFile &file, const char *name, size_t &size)
+{
+	uint64_t hash = Export::NameHash(name);
+	uint64_t bucket = hash & (file.info.bucketCount - 1);
+
+	for(unsigned i = file.buckets[bucket]; i < file.buckets[bucket + 1]; i++)
+	{
+		auto &entry = file.entries[i];
+
+		if(entry.nameHash == hash && strcmp(file.names + entry.nameOffset, name) == 0)
+		{
+			size = size_t(entry.size);
+
+			return (const unsigned char*)file.mapped.data + entry.offset;
+		}
+	}
+
+	return NULL;
+}
+
+// Index of the last key of the track that starts at or before the frame
+unsigned FindTrackKey(const unsigned char *keyFrames, const Export::AnimTrackInfo &track, unsigned frame)
+{
+	unsigned first = track.firstKey + 1;
+	unsigned count = track.keyCount - 1;
+
+	while(count > 0)
+	{
+		unsigned half = count / 2;
+
+		uint32_t keyFrame;
+		memcpy(&keyFrame, keyFrames + 4 * (first + half), 4);
+
+		if(keyFrame <= frame)
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
+
+	return first - 1;
+}
+
+void EvaluateObject(const ObjectFile &file, unsigned frame, ObjectPose &pose)
+{
+	pose.world.resize(file.nodeCount);
+	pose.bones.resize(file.boneCount);
+
+	for(unsigned i = 0; i < file.nodeCount; i++)
+		pose.world[i] = file.nodes[i].modelOriginal;
+
+	// Animated nodes take the key of the frame, chunk data may be unaligned in version 4, so keys are copied
+	const unsigned char *tracks = NULL;
+	const unsigned char *keyFrames = NULL;
+	const unsigned char *keys = NULL;
+
+	if(file.flags & Export::MF_CHUNKED_ANIMATION)
+	{
+		if(file.animChunkCount)
+		{
+			// Chunks are sorted by their first frame, the frame is in the last chunk that starts at or before it
+			const Export::AnimChunkInfo *first = file.animChunks;
+			const Export::AnimChunkInfo *last = file.animChunks + file.animChunkCount;
+
+			const Export::AnimChunkInfo *next = std::upper_bound(first + 1, last, frame, [](unsigned frame, const Export::AnimChunkInfo &chunkInfo){ return frame < chunkInfo.firstFrame; });
+
+			unsigned chunk = unsigned(next - first) - 1;
+
+			tracks = file.chunkData + file.animChunks[chunk].offset;
+
+			uint32_t keyCount;
+			memcpy(&keyCount, tracks + file.animNodeCount * sizeof(Export::AnimTrackInfo), 4);
+
+			keyFrames = tracks + file.animNodeCount * sizeof(Export::AnimTrackInfo) + 4;
+			keys = keyFrames + 4 * keyCount;
+		}
+	}
+	else if(file.animNodeCount)
+	{
+		tracks = (const unsigned char*)file.animTracks;
+		keyFrames = (const unsigned char*)file.animKeyFrames;
+		keys = (const unsigned char*)file.animKeys;
+	}
+
+	if(tracks)
+	{
+		for(unsigned i = 0; i < file.animNodeCount; i++)
+		{
+			Export::AnimTrackInfo track;
+			memcpy(&track, tracks + i * sizeof(track), sizeof(track));
+
+			unsigned key = FindTrackKey(keyFrames, track, frame);
+
+			memcpy(&pose.world[file.animNodes[i]], keys + sizeof(mat4) * key, sizeof(mat4));
+
+			pose.bytesTouched += sizeof(track) + 4 + sizeof(mat4);
+		}
+	}
+
+	// Parents precede their children
+	for(unsigned i = 0; i < file.nodeCount; i++)
+	{
+		unsigned parent = file.nodes[i].parentID;
+
+		if(parent != ~0u)
+		{
+			mat4 local = pose.world[i];
+
+			mul(pose.world[i], pose.world[parent], local);
+		}
+	}
+
+	for(unsigned i = 0; i < file.boneCount; i++)
+	{
+		unsigned node = file.boneNodes[i];
+
+		if(node != ~0u)
+			mul(pose.bones[i], pose.world[node], file.boneBindMats[i]);
+		else
+			pose.bones[i] = file.boneBindMats[i];
+	}
+}
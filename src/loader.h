@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vector>
+
+#include "export.h"
+
+struct MappedFile
+{
+	void *fileHandle;
+	void *mappingHandle;
+
+	void *data;
+	size_t size;
+};
+
+// Reference loader of geometry files
+// Version 2 files are mapped and their sections are used in place, version 1 files are read and copied to aligned memory
+struct GeometryFile
+{
+	Export::GeometryInfo info;
+
+	const uint32_t *format;
+
+	const void *vertexData;
+	const void *indexData;
+
+	// Storage behind the pointers
+	MappedFile mapped;
+
+	void *staging;
+};
+
+bool OpenGeometry(const char *path, GeometryFile &file);
+void CloseGeometry(GeometryFile &file);
+
+// Version 2 sections point into the data, so it has to outlive the file
+bool OpenGeometry(const void *data, size_t size, GeometryFile &file);
+
+// Reference loader of object files
+// Version 5 files are mapped and validated, version 4 files are read and their sections are copied to aligned memory in the version 5 order
+struct ObjectFile
+{
+	uint32_t version;
+	uint32_t flags;
+
+	uint32_t animSampleCount;
+	aabb bounds;
+
+	const Export::NodeInfo *nodes;
+	uint32_t nodeCount;
+
+	const Export::ControllerLayout *controllers;
+	uint32_t controllerCount;
+
+	const uint32_t *boneNodes;
+	const mat4 *boneBindMats;
+	const aabb *boneBounds;
+	uint32_t boneCount;
+
+	const uint32_t *animNodes;
+	uint32_t animNodeCount;
+
+	const Export::AnimTrackInfo *animTracks;	// Empty with MF_CHUNKED_ANIMATION
+
+	const uint32_t *animKeyFrames;
+	const mat4 *animKeys;
+	uint32_t animKeyCount;
+
+	const aabb *aabbState;
+	uint32_t aabbStateCount;
+
+	const Export::AnimChunkInfo *animChunks;
+	uint32_t animChunkCount;
+
+	const unsigned char *chunkData;	// Chunk offsets are relative to it
+
+	const Export::MaterialInfo *materials;
+	uint32_t materialCount;
+
+	const char *strings;
+	uint32_t stringSize;
+
+	size_t bytesTouched;	// Bytes of the file that were read to open it
+
+	// Storage behind the pointers
+	MappedFile mapped;
+
+	void *staging;
+	void *buffer;
+};
+
+bool OpenObject(const char *path, ObjectFile &file);
+void CloseObject(ObjectFile &file);
+
+// Sections of version 5 and animation chunks point into the data, so it has to outlive the file
+bool OpenObject(const void *data, size_t size, ObjectFile &file);
+
+// Transformations of an object at one frame
+struct ObjectPose
+{
+	std::vector<mat4> world;	// Model matrix of every node
+	std::vector<mat4> bones;	// Bone matrices, bones of controller N start at controllers[N].firstBone
+
+	size_t bytesTouched;	// Bytes of animation tracks and keys read by all evaluations
+};
+
+// Follows the steps at the end of export.h, frames past the end of the animation hold its last frame
+void EvaluateObject(const ObjectFile &file, unsigned frame, ObjectPose &pose);
+
+// Reader of archive files, the archive is mapped and files are found by name with a single bucket lookup
+struct ArchiveFile
+{
+	Export::ArchiveInfo info;
+
+	const Export::ArchiveEntry *entries;
+	const uint32_t *buckets;
+
+	const char *names;
+	uint32_t nameDataSize;
+
+	MappedFile mapped;
+};
+
+bool OpenArchive(const char *path, ArchiveFile &file);
+void CloseArchive(ArchiveFile &file);
+
+// Returns data of the file in the archive, or NULL if there is no such file
+const void* FindArchiveEntry(const ArchiveFile &file, const char *name, size_t &size);
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <memory.h>
 #include <string.h>
 #include <stdarg.h>
@@ -15,11 +16,20 @@
 
 #include "../meshoptimizer/src/meshoptimizer.hpp"
 
+#include "arena.h"
+#include "archive.h"
+#include "cache.h"
 #include "context.h"
 #include "export.h"
+#include "kernels.h"
+#include "output.h"
 
 Context global;
 
+ConvertOptions options;
+
+ConversionCache cache;
+
 const char* fastatoui(const char* str, unsigned& v)
 {
 	unsigned digit;
@@ -123,6 +133,9 @@ int fsize = 0;
 
 pugi::xml_document doc;
 
+// Parse-time data of the current file
+Arena arena;
+
 void LogPrint(const char* format, ...)
 {
 	va_list args;
@@ -173,6 +186,8 @@ void ParseFile(char* data)
 	doc.load(data);
 }
 
+void LogMemoryUsage(const char *stage);
+
 void LoadMaterialLibrary()
 {
 	LogPrint("Parsing images\r\n");
@@ -183,10 +198,10 @@ void LoadMaterialLibrary()
 		{
 			DAEImage image;
 
-			image.ID = img.attribute("id").value();
-			image.name = img.attribute("name").value();
+			image.ID = arena.Duplicate(img.attribute("id").value());
+			image.name = arena.Duplicate(img.attribute("name").value());
 
-			image.path = img.child("init_from").child_value();
+			image.path = arena.Duplicate(img.child("init_from").child_value());
 
 			auto fwd = strrchr(image.path, '/');
 			auto bkw = strrchr(image.path, '\\');
@@ -198,6 +213,7 @@ void LoadMaterialLibrary()
 			else if(bkw)
 				image.path = bkw + 1;
 
+			global.symbols.Add(SYM_IMAGE, image.ID, unsigned(global.images.size()), true);
 			global.images.push_back(image);
 		}
 	}
@@ -225,8 +241,8 @@ void LoadMaterialLibrary()
 
 			DAEEffect effect;
 
-			effect.ID = fx.attribute("id").value();
-			effect.name = fx.attribute("name").value();
+			effect.ID = arena.Duplicate(fx.attribute("id").value());
+			effect.name = arena.Duplicate(fx.attribute("name").value());
 
 			const char *diffuseColor = "";
 			const char *diffuseAlpha = "";
@@ -252,13 +268,7 @@ void LoadMaterialLibrary()
 				diffuseAlpha = constant.child("transparent").child("texture").attribute("texture").value();
 			}
 
-			effect.diffuseColor = ~0u;
-
-			for(unsigned i = 0; i < global.images.size(); i++)
-			{
-				if(strcmp(global.images[i].ID, diffuseColor) == 0)
-					effect.diffuseColor = i;
-			}
+			effect.diffuseColor = global.symbols.Find(SYM_IMAGE, diffuseColor);
 
 			if(effect.diffuseColor == ~0u)
 			{
@@ -269,24 +279,13 @@ void LoadMaterialLibrary()
 					auto it2 = surfaceMap.find(it->second);
 
 					if(it2 != surfaceMap.end())
-					{
-						for(unsigned i = 0; i < global.images.size(); i++)
-						{
-							if(strcmp(global.images[i].ID, it2->second.c_str()) == 0)
-								effect.diffuseColor = i;
-						}
-					}
+						effect.diffuseColor = global.symbols.Find(SYM_IMAGE, it2->second.c_str());
 				}
 			}
 
-			effect.diffuseAlpha = ~0u;
-
-			for(unsigned i = 0; i < global.images.size(); i++)
-			{
-				if(strcmp(global.images[i].ID, diffuseAlpha) == 0)
-					effect.diffuseAlpha = i;
-			}
+			effect.diffuseAlpha = global.symbols.Find(SYM_IMAGE, diffuseAlpha);
 
+			global.symbols.Add(SYM_EFFECT, effect.ID, unsigned(global.effects.size()), true);
 			global.effects.push_back(effect);
 		}
 	}
@@ -299,19 +298,14 @@ void LoadMaterialLibrary()
 		{
 			DAEMaterial material;
 
-			material.ID = mat.attribute("id").value();
-			material.name = mat.attribute("name").value();
+			material.ID = arena.Duplicate(mat.attribute("id").value());
+			material.name = arena.Duplicate(mat.attribute("name").value());
 
 			auto effect = mat.child("instance_effect").attribute("url").value();
 
-			material.effectID = ~0u;
-
-			for(unsigned i = 0; i < global.effects.size(); i++)
-			{
-				if(*effect && strcmp(global.effects[i].ID, effect + 1) == 0)
-					material.effectID = i;
-			}
+			material.effectID = *effect ? global.symbols.Find(SYM_EFFECT, effect + 1) : ~0u;
 
+			global.symbols.Add(SYM_MATERIAL, material.ID, unsigned(global.materials.size()), true);
 			global.materials.push_back(material);
 		}
 	}
@@ -331,16 +325,18 @@ void LoadGeometryLibrary()
 		if(!geom.child("mesh"))
 			continue;
 		LogOptional("geometry. ID: %s, Name: %s\r\n", geom.attribute("id").value(), geom.attribute("name").value());
-		global.geoms.push_back(new DAEGeometry());
+		global.geoms.push_back(arena.Create<DAEGeometry>());
 		DAEGeometry &geometry = *global.geoms.back();
-		geometry.ID = geom.attribute("id").value();
-		geometry.name = geom.attribute("name").value();
+		geometry.ID = arena.Duplicate(geom.attribute("id").value());
+		geometry.name = arena.Duplicate(geom.attribute("name").value());
+
+		global.symbols.Add(SYM_GEOMETRY, geometry.ID, unsigned(global.geoms.size() - 1), false);
 
 		for(pugi::xml_node source = geom.child("mesh").child("source"); source; source = source.next_sibling("source"))
 		{
 			float *targetArr = NULL;
 
-			geometry.streams[streamCount].name = source.attribute("id").value();
+			geometry.streams[streamCount].name = arena.Duplicate(source.attribute("id").value());
 			geometry.streams[streamCount].count = source.child("float_array").attribute("count").as_int();
 
 			pugi::xml_node accessor = source.child("technique_common").child("accessor");
@@ -490,6 +486,9 @@ void LoadGeometryLibrary()
 				const char *counts = t.child_value("vcount");
 				const char *rawArr = t.child_value("p");
 
+				// Only the used inputs are read, the rest of every group stays zero like in <triangles>
+				std::array<IndexGroup, 16> groups = {};
+
 				for(unsigned i = 0; i < count; i++)
 				{
 					while((unsigned)*counts <= ' ')
@@ -499,8 +498,6 @@ void LoadGeometryLibrary()
 
 					counts = fastatoui(counts, value);
 
-					std::array<IndexGroup, 16> groups;
-
 					for(unsigned i = 0; i < value; i++)
 					{
 						for(unsigned n = 0; n < inputsCount; n++)
@@ -546,6 +543,149 @@ void LoadGeometryLibrary()
 	}
 }
 
+// Geometry that is a skin source is saved with the weights of its controller, so it is never shared
+void CollectSkinnedGeometry(std::vector<bool> &skinned)
+{
+	skinned.assign(global.geoms.size(), false);
+
+	pugi::xml_node library = doc.child("COLLADA").child("library_controllers");
+
+	for(pugi::xml_node controller = library.child("controller"); controller; controller = controller.next_sibling("controller"))
+	{
+		const char *source = controller.child("skin").attribute("source").value();
+
+		unsigned geometryID = global.symbols.Find(SYM_GEOMETRY, *source == '#' ? source + 1 : source);
+
+		if(geometryID != ~0u)
+			skinned[geometryID] = true;
+	}
+}
+
+size_t GeometrySourceSize(const DAEGeometry &geometry)
+{
+	size_t size = sizeof(IndexGroup) * geometry.indCount;
+
+	for(int i = 0; i < MaxStreams; i++)
+	{
+		if(geometry.streams[i].data)
+			size += sizeof(float) * geometry.streams[i].count;
+	}
+
+	return size;
+}
+
+// Hash of everything that vertex and index buffers are built from, stream names are not included
+uint64_t GeometrySourceHash(const DAEGeometry &geometry)
+{
+	uint64_t hash = HashData(&geometry.indCount, sizeof(geometry.indCount), 14695981039346656037ull);
+
+	hash = HashData(geometry.streamLink.data(), sizeof(geometry.streamLink), hash);
+
+	for(int i = 0; i < MaxStreams; i++)
+	{
+		auto &stream = geometry.streams[i];
+
+		if(!stream.data)
+			continue;
+
+		hash = HashData(&stream.count, sizeof(stream.count), hash);
+		hash = HashData(&stream.stride, sizeof(stream.stride), hash);
+		hash = HashData(&stream.indexOffset, sizeof(stream.indexOffset), hash);
+		hash = HashData(stream.data, sizeof(float) * stream.count, hash);
+	}
+
+	return HashData(geometry.indices, sizeof(IndexGroup) * geometry.indCount, hash);
+}
+
+bool SameGeometrySource(const DAEGeometry &lhs, const DAEGeometry &rhs)
+{
+	if(lhs.indCount != rhs.indCount || lhs.streamLink != rhs.streamLink)
+		return false;
+
+	for(int i = 0; i < MaxStreams; i++)
+	{
+		auto &a = lhs.streams[i];
+		auto &b = rhs.streams[i];
+
+		if(!a.data != !b.data || a.count != b.count || a.stride != b.stride || a.indexOffset != b.indexOffset)
+			return false;
+
+		if(a.data && memcmp(a.data, b.data, sizeof(float) * a.count) != 0)
+			return false;
+	}
+
+	return memcmp(lhs.indices, rhs.indices, sizeof(IndexGroup) * lhs.indCount) == 0;
+}
+
+// Copies of a mesh under different IDs are collapsed to the first one before vertex and index buffers are built
+void CollapseDuplicateGeometry()
+{
+	unsigned startTime = clock();
+
+	std::vector<bool> skinned;
+	CollectSkinnedGeometry(skinned);
+
+	std::unordered_map<uint64_t, std::vector<unsigned>> candidates;
+
+	std::vector<DAEGeometry*> unique;
+	std::vector<unsigned> redirection(global.geoms.size());
+
+	unsigned duplicateCount = 0;
+	size_t savedSize = 0;
+
+	for(unsigned i = 0; i < global.geoms.size(); i++)
+	{
+		DAEGeometry *geometry = global.geoms[i];
+
+		unsigned original = ~0u;
+
+		if(!skinned[i])
+		{
+			auto &list = candidates[GeometrySourceHash(*geometry)];
+
+			for(unsigned k = 0; k < list.size() && original == ~0u; k++)
+			{
+				if(SameGeometrySource(*unique[list[k]], *geometry))
+					original = list[k];
+			}
+
+			if(original == ~0u)
+				list.push_back(unsigned(unique.size()));
+		}
+
+		if(original != ~0u)
+		{
+			LogOptional("  Geometry %s is a copy of %s\r\n", geometry->ID, unique[original]->ID);
+
+			savedSize += GeometrySourceSize(*geometry);
+			duplicateCount++;
+
+			geometry->Free();
+
+			redirection[i] = original;
+		}
+		else
+		{
+			redirection[i] = unsigned(unique.size());
+			unique.push_back(geometry);
+		}
+	}
+
+	// Nodes and controllers find geometry through the symbol table, so the IDs of the copies lead to the original
+	if(duplicateCount)
+	{
+		for(unsigned i = 0; i < global.geoms.size(); i++)
+		{
+			if(global.symbols.Find(SYM_GEOMETRY, global.geoms[i]->ID) == i)
+				global.symbols.Add(SYM_GEOMETRY, global.geoms[i]->ID, redirection[i], true);
+		}
+
+		global.geoms.swap(unique);
+	}
+
+	LogPrint("%dms to find %d duplicate geometries out of %d (%d KB of source data is not converted)\r\n", clock() - startTime, duplicateCount, unsigned(global.geoms.size() + duplicateCount), unsigned(savedSize / 1024));
+}
+
 namespace std
 {
 	template<> struct hash<IndexGroup>
@@ -805,25 +945,123 @@ void CreateIBVB()
 	}
 }
 
+// Prefix tree of all node names in the document, used to split joint name arrays where names may contain spaces
+struct NameTrie
+{
+	NameTrie(): built(false)
+	{
+	}
+
+	void Clear()
+	{
+		edges.clear();
+		terminal.clear();
+
+		built = false;
+	}
+
+	void Build()
+	{
+		Clear();
+
+		terminal.push_back(false);
+
+		for(pugi::xml_node n = doc.first_child(); n;)
+		{
+			if(strcmp(n.name(), "node") == 0)
+				Insert(n.attribute("name").value());
+
+			if(n.first_child())
+			{
+				n = n.first_child();
+				continue;
+			}
+
+			while(n && !n.next_sibling())
+				n = n.parent();
+
+			if(n)
+				n = n.next_sibling();
+		}
+
+		built = true;
+
+		LogOptional("Node name tree has %d states\r\n", unsigned(terminal.size()));
+	}
+
+	void Insert(const char *name)
+	{
+		unsigned state = 0;
+
+		for(; *name; name++)
+		{
+			auto it = edges.insert(std::make_pair(Edge(state, *name), unsigned(terminal.size())));
+
+			if(it.second)
+				terminal.push_back(false);
+
+			state = it.first->second;
+		}
+
+		terminal[state] = true;
+	}
+
+	// Length of the longest node name that is a prefix of the string
+	unsigned LongestMatch(const char *str, size_t length) const
+	{
+		unsigned state = 0;
+		unsigned match = 0;
+
+		for(unsigned i = 0; i < length; i++)
+		{
+			auto it = edges.find(Edge(state, str[i]));
+
+			if(it == edges.end())
+				break;
+
+			state = it->second;
+
+			if(terminal[state])
+				match = i + 1;
+		}
+
+		return match;
+	}
+
+	static uint64_t Edge(unsigned state, char ch)
+	{
+		return (uint64_t(state) << 8) | (unsigned char)ch;
+	}
+
+	std::unordered_map<uint64_t, unsigned> edges;
+	std::vector<bool> terminal;
+
+	bool built;
+};
+
+NameTrie nodeNames;
+
 DAESource ParseSource(pugi::xml_node source, bool specialCaseNameArray = false)
 {
 	DAESource src;
 
-	src.ID = source.attribute("id").value();
+	src.ID = arena.Duplicate(source.attribute("id").value());
 	src.count = source.child("technique_common").child("accessor").attribute("count").as_int();
 	src.stride = source.child("technique_common").child("accessor").attribute("stride").as_int(1);
 
 	if(source.child("Name_array"))
 	{
-		src.dataNameBlob = strdup(source.child_value("Name_array"));
-		src.dataName = new char*[src.count * src.stride];
+		src.dataNameBlob = arena.Duplicate(source.child_value("Name_array"));
+		src.dataName = arena.AllocateArray<char*>(src.count * src.stride);
 
 		char *rawArr = src.dataNameBlob;
 		char **target = src.dataName;
 
 		if(specialCaseNameArray)
 		{
-			pugi::xpath_node_set nodeSet = doc.child("COLLADA").child("library_visual_scenes").select_nodes("//node");
+			// Tree is shared by all controllers of the document
+			if(!nodeNames.built)
+				nodeNames.Build();
 
 			auto remainingLength = strlen(rawArr);
 
@@ -835,16 +1073,7 @@ DAESource ParseSource(pugi::xml_node source, bool specialCaseNameArray = false)
 					remainingLength--;
 				}
 
-				unsigned largestMatchSize = 0;
-
-				for(pugi::xpath_node_set::const_iterator node = nodeSet.begin(); node != nodeSet.end(); node++)
-				{
-					auto name = node->node().attribute("name").value();
-					auto nameLength = (unsigned)strlen(name);
-
-					if(nameLength <= remainingLength && nameLength > largestMatchSize && memcmp(rawArr, name, nameLength) == 0)
-						largestMatchSize = nameLength;
-				}
+				unsigned largestMatchSize = nodeNames.LongestMatch(rawArr, remainingLength);
 
 				assert(largestMatchSize != 0);
 
@@ -874,7 +1103,7 @@ DAESource ParseSource(pugi::xml_node source, bool specialCaseNameArray = false)
 	}
 	else if(source.child("float_array"))
 	{
-		src.dataFloat.resize(src.count * src.stride);
+		src.dataFloat = arena.AllocateArray<float>(src.count * src.stride);
 
 		const char *rawArr = source.child_value("float_array");
 
@@ -927,6 +1156,70 @@ DAESource* FindSource(const char* ID, DAESource* sources, unsigned count)
 std::vector<DAESource> animSource;
 std::vector<DAEAnimation*> anims;
 
+enum SamplerInput
+{
+	SI_INPUT,
+	SI_OUTPUT,
+	SI_IN_TANGENT,
+	SI_OUT_TANGENT,
+	SI_INTERPOLATION,
+
+	SI_COUNT
+};
+
+static const char *samplerInputName[] = {
+	"INPUT",
+	"OUTPUT",
+	"IN_TANGENT",
+	"OUT_TANGENT",
+	"INTERPOLATION",
+};
+
+struct AnimationLibraryIndex
+{
+	std::unordered_map<std::string, unsigned> sources;	// Source ID to the index in animSource, first declaration is used
+	std::unordered_map<std::string, pugi::xml_node> samplers;
+
+	std::vector<pugi::xml_node> channels;
+};
+
+// Collects sources, samplers and channels of the animation and its nested animations in document order
+void IndexAnimation(pugi::xml_node animation, AnimationLibraryIndex &index)
+{
+	for(pugi::xml_node child = animation.first_child(); child; child = child.next_sibling())
+	{
+		const char *name = child.name();
+
+		if(strcmp(name, "source") == 0)
+		{
+			index.sources.insert(std::make_pair(std::string(child.attribute("id").value()), unsigned(animSource.size())));
+			animSource.push_back(ParseSource(child));
+		}
+		else if(strcmp(name, "sampler") == 0)
+		{
+			index.samplers.insert(std::make_pair(std::string(child.attribute("id").value()), child));
+		}
+		else if(strcmp(name, "channel") == 0)
+		{
+			index.channels.push_back(child);
+		}
+		else if(strcmp(name, "animation") == 0)
+		{
+			IndexAnimation(child, index);
+		}
+	}
+}
+
+DAESource* FindAnimationSource(const AnimationLibraryIndex &index, const char* ID)
+{
+	if(!ID || !*ID)
+		return NULL;
+
+	auto it = index.sources.find(ID + 1);
+
+	return it != index.sources.end() ? &animSource[it->second] : NULL;
+}
+
 void LoadAnimationLibrary()
 {
 	anims.clear();
@@ -941,16 +1234,16 @@ void LoadAnimationLibrary()
 	// Get all sources for parsing
 	animSource.clear();
 
-	pugi::xpath_node_set nodeSet = library.select_nodes("animation//source");
+	AnimationLibraryIndex index;
 
-	for(pugi::xpath_node_set::const_iterator node = nodeSet.begin(); node != nodeSet.end(); node++)
-		animSource.push_back(ParseSource(node->node()));
+	for(pugi::xml_node animation = library.child("animation"); animation; animation = animation.next_sibling("animation"))
+		IndexAnimation(animation, index);
 
-	nodeSet = library.select_nodes("animation//channel");
+	LogOptional("Found %d sources, %d samplers and %d channels\r\n", unsigned(animSource.size()), unsigned(index.samplers.size()), unsigned(index.channels.size()));
 
-	for(pugi::xpath_node_set::const_iterator node = nodeSet.begin(); node != nodeSet.end(); node++)
+	for(unsigned channel = 0; channel < index.channels.size(); channel++)
 	{
-		const pugi::xml_node animation = node->node();
+		const pugi::xml_node animation = index.channels[channel];
 
 		auto animName = animation;
 
@@ -964,13 +1257,13 @@ void LoadAnimationLibrary()
 		
 		LogOptional("Loading animation \"%s\"\r\n", animName.attribute("id").value());
 
-		anims.push_back(new DAEAnimation());
+		anims.push_back(arena.Create<DAEAnimation>());
 		DAEAnimation &last = *anims.back();
 		memset(&last, 0, sizeof(DAEAnimation));
 
-		last.ID = animName.attribute("id").value();
+		last.ID = arena.Duplicate(animName.attribute("id").value());
 
-		last.targetNode = strdup(animation.attribute("target").value());
+		last.targetNode = arena.Duplicate(animation.attribute("target").value());
 		char *dividerPos = strchr(last.targetNode, '/');
 
 		if(dividerPos)
@@ -1015,24 +1308,52 @@ void LoadAnimationLibrary()
 			}
 		}
 
-		pugi::xpath_variable_set vars;
-		vars.set("samp_name", animation.attribute("source").value() + 1);
+		const char *samplerName = animation.attribute("source").value() + 1;
 
 		assert(strcmp("animation", animation.parent().name()) == 0);
 		pugi::xml_node parent = animation.parent();
 
-		last.inSource = FindSource(parent.select_single_node("sampler[@id = $samp_name]/input[@semantic='INPUT']/@source", &vars).attribute().value(), animSource.data(), animSource.size());
+		// Sampler has to be declared in the same animation as the channel
+		pugi::xml_node sampler;
+
+		auto samplerIt = index.samplers.find(samplerName);
+
+		if(samplerIt != index.samplers.end() && samplerIt->second.parent() == parent)
+		{
+			sampler = samplerIt->second;
+		}
+		else
+		{
+			for(pugi::xml_node s = parent.child("sampler"); s && !sampler; s = s.next_sibling("sampler"))
+			{
+				if(strcmp(s.attribute("id").value(), samplerName) == 0)
+					sampler = s;
+			}
+		}
+
+		const char *inputs[SI_COUNT] = {};
+
+		for(pugi::xml_node input = sampler.child("input"); input; input = input.next_sibling("input"))
+		{
+			for(unsigned i = 0; i < SI_COUNT; i++)
+			{
+				if(!inputs[i] && strcmp(input.attribute("semantic").value(), samplerInputName[i]) == 0)
+					inputs[i] = input.attribute("source").value();
+			}
+		}
+
+		last.inSource = FindAnimationSource(index, inputs[SI_INPUT]);
 		assert(last.inSource);
-		last.outSource = FindSource(parent.select_single_node("sampler[@id = $samp_name]/input[@semantic='OUTPUT']/@source", &vars).attribute().value(), animSource.data(), animSource.size());
+		last.outSource = FindAnimationSource(index, inputs[SI_OUTPUT]);
 		assert(last.outSource);
-		last.inTangentSource = FindSource(parent.select_single_node("sampler[@id = $samp_name]/input[@semantic='IN_TANGENT']/@source", &vars).attribute().value(), animSource.data(), animSource.size());
-		last.outTangentSource = FindSource(parent.select_single_node("sampler[@id = $samp_name]/input[@semantic='OUT_TANGENT']/@source", &vars).attribute().value(), animSource.data(), animSource.size());
-		last.interpolationStr = FindSource(parent.select_single_node("sampler[@id = $samp_name]/input[@semantic='INTERPOLATION']/@source", &vars).attribute().value(), animSource.data(), animSource.size());
+		last.inTangentSource = FindAnimationSource(index, inputs[SI_IN_TANGENT]);
+		last.outTangentSource = FindAnimationSource(index, inputs[SI_OUT_TANGENT]);
+		last.interpolationStr = FindAnimationSource(index, inputs[SI_INTERPOLATION]);
 
 		last.dataCount = last.inSource->count;
 
 		assert(last.interpolationStr);
-		last.interpolation = new Interpolation[last.interpolationStr->count * last.interpolationStr->stride];
+		last.interpolation = arena.AllocateArray<Interpolation>(last.interpolationStr->count * last.interpolationStr->stride);
 
 		for(unsigned i = 0; i < last.interpolationStr->count * last.interpolationStr->stride; i++)
 		{
@@ -1077,11 +1398,13 @@ void LoadControllerLibrary()
 	{
 		LogOptional("id: %s\r\n", controller.attribute("id").value());
 
-		global.contrls.push_back(new DAEController());
+		global.contrls.push_back(arena.Create<DAEController>());
 		DAEController &curr = *global.contrls.back();
 		memset(&curr, 0, sizeof(DAEController));
 
-		curr.ID = controller.attribute("id").value();
+		curr.ID = arena.Duplicate(controller.attribute("id").value());
+
+		global.symbols.Add(SYM_CONTROLLER, curr.ID, unsigned(global.contrls.size() - 1), false);
 
 		// Find skin node
 		pugi::xml_node skin = controller.child("skin");
@@ -1089,20 +1412,11 @@ void LoadControllerLibrary()
 
 		LogOptional("source: %s\r\n", skin.attribute("source").value());
 
-		curr.source = skin.attribute("source").value(); // save source geometry name
+		curr.source = arena.Duplicate(skin.attribute("source").value()); // save source geometry name
 
 		// Find corresponding geometry index
 		const char *targetName = curr.source + 1;
-		curr.geometryID = -1;
-
-		for(unsigned i = 0; i < global.geoms.size(); i++)
-		{
-			if(strcmp(global.geoms[i]->ID, targetName) == 0)
-			{
-				curr.geometryID = i;
-				break;
-			}
-		}
+		curr.geometryID = global.symbols.Find(SYM_GEOMETRY, targetName);
 
 		LogOptional("geometryID: %d\r\n", curr.geometryID);
 
@@ -1140,15 +1454,15 @@ void LoadControllerLibrary()
 		assert(curr.joints == FindSource(skin.select_single_node("vertex_weights/input[@semantic='JOINT']/@source").attribute().value(), curr.sources.data(), curr.sourceCount));
 		curr.weights = FindSource(skin.select_single_node("vertex_weights/input[@semantic='WEIGHT']/@source").attribute().value(), curr.sources.data(), curr.sourceCount);
 
-		assert(curr.binds && !curr.binds->dataFloat.empty() && curr.binds->stride == 16);
+		assert(curr.binds && curr.binds->count * curr.binds->stride != 0 && curr.binds->stride == 16);
 		assert(curr.joints && curr.joints->dataName && curr.joints->stride == 1);
-		assert(curr.weights && !curr.weights->dataFloat.empty() && curr.weights->stride == 1);
+		assert(curr.weights && curr.weights->count * curr.weights->stride != 0 && curr.weights->stride == 1);
 
 		pugi::xml_node weights = skin.child("vertex_weights");
 		assert(weights);
 
 		curr.vcountCount = weights.attribute("count").as_int();
-		curr.vcountData = new unsigned[curr.vcountCount];
+		curr.vcountData = arena.AllocateArray<unsigned>(curr.vcountCount);
 
 		LogOptional("\tvcount count: %d\r\n", curr.vcountCount);
 
@@ -1165,7 +1479,7 @@ void LoadControllerLibrary()
 		}
 
 		curr.vCount = vCount * 2;
-		curr.vData = new int[curr.vCount];
+		curr.vData = arena.AllocateArray<int>(curr.vCount);
 
 		LogOptional("\tv count: %d\r\n", curr.vCount);
 
@@ -1190,18 +1504,18 @@ void LoadControllerLibrary()
 	{
 		DAEController &curr = *global.contrls[i];
 
-		curr.exIndices = new unsigned char[curr.vcountCount * 4];
-		curr.exWeights = new short[curr.vcountCount * 4];
-		curr.bounds = new aabb[curr.joints->count];
+		curr.exIndices = arena.AllocateArray<unsigned char>(curr.vcountCount * 4);
+		curr.exWeights = arena.AllocateArray<short>(curr.vcountCount * 4);
+		curr.bounds = arena.AllocateArray<aabb>(curr.joints->count);
 
-		curr.isJointActive = new bool[curr.joints->count];
+		curr.isJointActive = arena.AllocateArray<bool>(curr.joints->count);
 		memset(curr.isJointActive, 0, sizeof(bool) * curr.joints->count);
 
 		curr.activeJointCount = 0;
-		curr.activeJointIDs = new unsigned[curr.joints->count];
+		curr.activeJointIDs = arena.AllocateArray<unsigned>(curr.joints->count);
 		memset(curr.activeJointIDs, 0, sizeof(unsigned) * curr.joints->count);
 
-		curr.jointRemap = new unsigned[curr.joints->count];
+		curr.jointRemap = arena.AllocateArray<unsigned>(curr.joints->count);
 		memset(curr.jointRemap, 0, sizeof(unsigned) * curr.joints->count);
 
 		for(unsigned n = 0; n < curr.joints->count; n++)
@@ -1335,27 +1649,80 @@ void LoadControllerLibrary()
 	}
 }
 
-unsigned NodeDepth(pugi::xml_node n)
+// Transformation of an animated node
+struct TransformBlock
+{
+	DAETransformBlock block;
+	unsigned count;
+};
+
+// Transformation elements that are not touched by any animation are folded into constant matrices
+struct TransformState
 {
-	unsigned d = 0;
+	unsigned firstAnimated;
+	unsigned lastAnimated;
+
+	bool isAnimated[8];
+
+	mat4 prefix;	// Product of the elements before the first animated element
+	mat4 suffix;	// Product of the elements after the last animated element
 
-	while(n)
+	mat4 constant[8];	// Matrices of the static elements between the first and the last animated element
+};
+
+// Animation is sampled on request, a window of frames at a time
+struct AnimationSampler
+{
+	AnimationSampler(): startTime(0.0), step(1.0 / 30.0), nextFrame(0), sampleTime(0)
 	{
-		d++;
-		n = n.parent();
 	}
 
-	return d;
+	std::vector<TransformBlock> idleMat;
+	std::vector<TransformState> idleState;
+
+	std::vector<TransformBlock> tempCopy;
+
+	double startTime;
+	double step;
+
+	unsigned nextFrame;
+	unsigned sampleTime;
+};
+
+AnimationSampler sampler;
+
+void CalculateTransform(mat4 &target, const DAETransform &transform)
+{
+	target.identity();
+
+	switch(transform.type)
+	{
+	case DT_MATRIX:
+		memcpy(&target.mat[0], transform.data, 16 * sizeof(float));
+		target = target.transpose();
+		break;
+	case DT_ROTATE:
+		target.rotate(vec3(transform.data), transform.data[3]);
+		break;
+	case DT_TRANSLATE:
+		target.translate(vec3(transform.data));
+		break;
+	case DT_SCALE:
+		target.scale(vec3(transform.data));
+		break;
+	case DT_LOOKAT:
+	case DT_SKEW:
+		break;
+	}
 }
 
 bool LoadScene()
 {
-	std::array<unsigned, 128> stack;
-
-	unsigned top = 0;
 	global.nodes.clear();
 	global.skeletons.clear();
-	global.matrixAnimation = NULL;
+	global.transforms.clear();
+	global.jointNodes.clear();
+	global.jointBindMat.clear();
 
 	pugi::xml_node scene = doc.child("COLLADA").child("library_visual_scenes").child("visual_scene");
 
@@ -1368,36 +1735,74 @@ bool LoadScene()
 	DAESkeleton newSkeleton;
 	mat4 tempTransform;
 
-	unsigned sDepth = NodeDepth(scene);
-	pugi::xpath_node_set nodeSet = scene.select_nodes("//node");
-	nodeSet.sort();
+	// Depth-first traversal in document order, pending nodes are kept with the index of their parent
+	std::vector<std::pair<pugi::xml_node, unsigned>> pending;
+	std::vector<pugi::xml_node> children;
+
+	for(pugi::xml_node s = scene; s; s = s.next_sibling("visual_scene"))
+	{
+		for(pugi::xml_node n = s.child("node"); n; n = n.next_sibling("node"))
+			children.push_back(n);
+	}
 
-	for(pugi::xpath_node_set::const_iterator node = nodeSet.begin(); node != nodeSet.end(); node++)
+	for(unsigned i = unsigned(children.size()); i > 0; i--)
+		pending.push_back(std::make_pair(children[i - 1], ~0u));
+
+	while(!pending.empty())
 	{
-		const pugi::xml_node n = node->node();
+		const pugi::xml_node n = pending.back().first;
+
+		newNode.parentNodeID = pending.back().second;
 
-		unsigned depth = NodeDepth(n);
-		assert(depth < 128);
-		stack[depth - sDepth] = unsigned(global.nodes.size());
+		pending.pop_back();
 
 		// Save name
-		newNode.ID = n.attribute("id").value();
-		newNode.name = n.attribute("name").value();
-		newNode.sid = n.attribute("sid").value();	// Not necessarily present, but (NULL, NULL) string will be fine
+		newNode.ID = arena.Duplicate(n.attribute("id").value());
+		newNode.name = arena.Duplicate(n.attribute("name").value());
+		newNode.sid = arena.Duplicate(n.attribute("sid").value());	// Not necessarily present, but an empty string will be fine
 
 		// Is it a joint?
 		newNode.isJoint = strcmp("JOINT", n.attribute("type").value()) == 0;
 
-		// Find transformation matrix
+		// Find transformation matrix, instances and child nodes
 		newNode.model.identity();
+		newNode.firstTransform = unsigned(global.transforms.size());
 		newNode.tCount = 0;
 
-		pugi::xpath_node_set transforms = n.select_nodes("./matrix | ./rotate | ./translate | ./scale | ./lookat | ./skew");
-		transforms.sort();
+		pugi::xml_node geom, contrl;
 
-		for(pugi::xpath_node_set::const_iterator transform = transforms.begin(); transform != transforms.end(); transform++)
+		children.clear();
+
+		for(pugi::xml_node t = n.first_child(); t; t = t.next_sibling())
 		{
-			const pugi::xml_node t = transform->node();
+			const char *name = t.name();
+
+			if(strcmp(name, "node") == 0)
+			{
+				children.push_back(t);
+				continue;
+			}
+			else if(strcmp(name, "instance_geometry") == 0)
+			{
+				if(!geom)
+					geom = t;
+				continue;
+			}
+			else if(strcmp(name, "instance_controller") == 0)
+			{
+				if(!contrl)
+					contrl = t;
+				continue;
+			}
+
+			if(newNode.tCount == MaxNodeTransforms)
+			{
+				LogPrint("Node %s has more than %d transformation elements, '%s' is ignored\r\n", newNode.ID, MaxNodeTransforms, name);
+				continue;
+			}
+
+			DAETransform transform;
+
 			tempTransform.identity();
 
 			if(strcmp(t.name(), "matrix") == 0)
@@ -1407,11 +1812,12 @@ bool LoadScene()
 				for(int n = 0; n < 16; n++)
 					str = fastatof(str, tempTransform.mat[n]) + 1;
 
-				newNode.tForm[newNode.tCount].type = DT_MATRIX;
-				newNode.tForm[newNode.tCount].sid = t.attribute("sid").value();
-				memcpy(newNode.tForm[newNode.tCount].data, &tempTransform.mat[0], sizeof(float) * 16);
+				transform.type = DT_MATRIX;
+				transform.sid = arena.Duplicate(t.attribute("sid").value());
+				memcpy(transform.data, &tempTransform.mat[0], sizeof(float) * 16);
 
 				tempTransform = tempTransform.transpose();
+				global.transforms.push_back(transform);
 				newNode.tCount++;
 			}
 			else if(strcmp(t.name(), "rotate") == 0)
@@ -1423,11 +1829,12 @@ bool LoadScene()
 				for(int n = 0; n < 4; n++)
 					str = fastatof(str, rotateData[n]) + 1;
 
-				newNode.tForm[newNode.tCount].type = DT_ROTATE;
-				newNode.tForm[newNode.tCount].sid = t.attribute("sid").value();
-				memcpy(newNode.tForm[newNode.tCount].data, rotateData, sizeof(float) * 4);
+				transform.type = DT_ROTATE;
+				transform.sid = arena.Duplicate(t.attribute("sid").value());
+				memcpy(transform.data, rotateData, sizeof(float) * 4);
 
 				tempTransform.rotate(vec3(rotateData), rotateData[3]);
+				global.transforms.push_back(transform);
 				newNode.tCount++;
 			}
 			else if(strcmp(t.name(), "translate") == 0)
@@ -1439,11 +1846,12 @@ bool LoadScene()
 				for(int n = 0; n < 3; n++)
 					str = fastatof(str, translateData[n]) + 1;
 
-				newNode.tForm[newNode.tCount].type = DT_TRANSLATE;
-				newNode.tForm[newNode.tCount].sid = t.attribute("sid").value();
-				memcpy(newNode.tForm[newNode.tCount].data, translateData, sizeof(float) * 3);
+				transform.type = DT_TRANSLATE;
+				transform.sid = arena.Duplicate(t.attribute("sid").value());
+				memcpy(transform.data, translateData, sizeof(float) * 3);
 
 				tempTransform.translate(vec3(translateData));
+				global.transforms.push_back(transform);
 				newNode.tCount++;
 			}
 			else if(strcmp(t.name(), "scale") == 0)
@@ -1455,31 +1863,38 @@ bool LoadScene()
 				for(int n = 0; n < 3; n++)
 					str = fastatof(str, scaleData[n]) + 1;
 
-				newNode.tForm[newNode.tCount].type = DT_SCALE;
-				newNode.tForm[newNode.tCount].sid = t.attribute("sid").value();
-				memcpy(newNode.tForm[newNode.tCount].data, scaleData, sizeof(float) * 3);
+				transform.type = DT_SCALE;
+				transform.sid = arena.Duplicate(t.attribute("sid").value());
+				memcpy(transform.data, scaleData, sizeof(float) * 3);
 
 				tempTransform.scale(vec3(scaleData));
+				global.transforms.push_back(transform);
 				newNode.tCount++;
 			}
 			else if(strcmp(t.name(), "lookat") == 0)
 			{
-				newNode.tForm[newNode.tCount].type = DT_LOOKAT;
-				newNode.tForm[newNode.tCount].sid = t.attribute("sid").value();
+				transform.type = DT_LOOKAT;
+				transform.sid = arena.Duplicate(t.attribute("sid").value());
 
 				assert(!"<lookat> not implemented!");
 				LogPrint("<lookat> not implemented!\r\n");
+				global.transforms.push_back(transform);
 				newNode.tCount++;
 			}
 			else if(strcmp(t.name(), "skew") == 0)
 			{
-				newNode.tForm[newNode.tCount].type = DT_SKEW;
-				newNode.tForm[newNode.tCount].sid = t.attribute("sid").value();
+				transform.type = DT_SKEW;
+				transform.sid = arena.Duplicate(t.attribute("sid").value());
 
 				assert(!"<skew> not implemented!");
 				LogPrint("<skew> not implemented!\r\n");
+				global.transforms.push_back(transform);
 				newNode.tCount++;
 			}
+			else
+			{
+				continue;
+			}
 
 			newNode.model *= tempTransform;
 		}
@@ -1489,20 +1904,11 @@ bool LoadScene()
 
 		newNode.effectID = ~0u;
 
-		pugi::xml_node geom = n.child("instance_geometry");
-
 		if(geom)
 		{
 			const char* str = geom.attribute("url").value() + 1;
 
-			for(unsigned i = 0; i < global.geoms.size(); i++)
-			{
-				if(strcmp(str, global.geoms[i]->ID) == 0)
-				{
-					newNode.geometryID = i;
-					break;
-				}
-			}
+			newNode.geometryID = global.symbols.Find(SYM_GEOMETRY, str);
 
 			// Find material
 			pugi::xml_node mat = geom.child("bind_material").child("technique_common").child("instance_material");
@@ -1510,46 +1916,27 @@ bool LoadScene()
 
 			if(*matTarget)
 			{
-				for(unsigned i = 0; i < global.materials.size(); i++)
-				{
-					if(strcmp(global.materials[i].ID, matTarget + 1) == 0)
-						newNode.effectID = global.materials[i].effectID;
-				}
+				unsigned materialID = global.symbols.Find(SYM_MATERIAL, matTarget + 1);
+
+				if(materialID != ~0u)
+					newNode.effectID = global.materials[materialID].effectID;
 			}
 		}
 
-		assert(depth != sDepth);
-
-		if(depth == sDepth + 1)
-		{
-			newNode.parentNodeID = -1;
-		}
-		else
-		{
-			newNode.parentNodeID = stack[depth - sDepth - 1];
+		if(newNode.parentNodeID != -1)
 			global.nodes[newNode.parentNodeID].childCount++;
-		}
 
 		newNode.childCount = 0;
 
 		newNode.controllerID = -1;
 		newNode.skeletonID = -1;
 
-		pugi::xml_node contrl = n.child("instance_controller");
-
 		if(contrl)
 		{
 			// Find controller number
 			const char* targetName = contrl.attribute("url").value() + 1;
 
-			for(unsigned i = 0; i < global.contrls.size(); i++)
-			{
-				if(strcmp(targetName, global.contrls[i]->ID) == 0)
-				{
-					newNode.controllerID = i;
-					break;
-				}
-			}
+			newNode.controllerID = global.symbols.Find(SYM_CONTROLLER, targetName);
 
 			if(newNode.controllerID == -1)
 				LogOptional("Controller %s is referenced, but not found\r\n", targetName);
@@ -1561,20 +1948,23 @@ bool LoadScene()
 
 			if(*matTarget)
 			{
-				for(unsigned i = 0; i < global.materials.size(); i++)
-				{
-					if(strcmp(global.materials[i].ID, matTarget + 1) == 0)
-						newNode.effectID = global.materials[i].effectID;
-				}
+				unsigned materialID = global.symbols.Find(SYM_MATERIAL, matTarget + 1);
+
+				if(materialID != ~0u)
+					newNode.effectID = global.materials[materialID].effectID;
 			}
 
 			newSkeleton.controllerID = newNode.controllerID;
 			newSkeleton.jointCount = global.contrls[newNode.controllerID]->activeJointCount;
+			newSkeleton.firstJoint = unsigned(global.jointNodes.size());
+
+			global.jointNodes.resize(global.jointNodes.size() + newSkeleton.jointCount);
+			global.jointBindMat.resize(global.jointBindMat.size() + newSkeleton.jointCount);
 			newNode.skeletonID = unsigned(global.skeletons.size());
 
 			// Find root nodes for search
 			for(auto skeleton = contrl.child("skeleton"); skeleton; skeleton = skeleton.next_sibling("skeleton"))
-				newSkeleton.rootNames.push_back(skeleton.child_value() + 1);
+				newSkeleton.rootNames.push_back(arena.Duplicate(skeleton.child_value() + 1));
 
 			if(!newSkeleton.rootNames.empty())
 				LogOptional("Skeleton for %s has %d roots (first start from %s)\r\n", targetName, newSkeleton.rootNames.size(), newSkeleton.rootNames.front());
@@ -1590,13 +1980,55 @@ bool LoadScene()
 			LogOptional("%f; ", newNode.model.mat[m]);
 		LogOptional("\r\n");
 
+		for(unsigned i = unsigned(children.size()); i > 0; i--)
+			pending.push_back(std::make_pair(children[i - 1], unsigned(global.nodes.size())));
+
+		global.symbols.Add(SYM_NODE, newNode.ID, unsigned(global.nodes.size()), false);
 		global.nodes.push_back(newNode);
 	}
 
+	LogPrint("Parsed %d nodes\r\n", unsigned(global.nodes.size()));
+	LogPrint("%d bytes in nodes, %d bytes in transformation elements\r\n", unsigned(sizeof(DAENode) * global.nodes.size()), unsigned(sizeof(DAETransform) * global.transforms.size()));
+
+	for(unsigned i = unsigned(global.nodes.size()); i > 0; i--)
+	{
+		auto &node = global.nodes[i - 1];
+
+		if(node.subtreeEnd < i)
+			node.subtreeEnd = i;
+
+		if(node.parentNodeID != -1 && global.nodes[node.parentNodeID].subtreeEnd < node.subtreeEnd)
+			global.nodes[node.parentNodeID].subtreeEnd = node.subtreeEnd;
+	}
+
+	unsigned bindStartTime = clock();
+	unsigned jointCount = 0;
+
+	// Nodes with the same sid in document order
+	std::unordered_map<std::string, std::vector<unsigned>> sidNodes;
+
+	for(unsigned i = 0; i < global.nodes.size(); i++)
+	{
+		if(global.nodes[i].sid != NULL)
+			sidNodes[global.nodes[i].sid].push_back(i);
+	}
+
+	std::vector<unsigned> rootNodes;
+
 	for(unsigned i = 0; i < global.skeletons.size(); i++)
 	{
 		DAESkeleton &cSkel = global.skeletons[i];
 
+		rootNodes.clear();
+
+		for(unsigned k = 0; k < cSkel.rootNames.size(); k++)
+		{
+			unsigned rootID = global.symbols.Find(SYM_NODE, cSkel.rootNames[k]);
+
+			if(rootID != ~0u)
+				rootNodes.push_back(rootID);
+		}
+
 		// Find every joint position after root node
 		for(unsigned n = 0; n < cSkel.jointCount; n++)
 		{
@@ -1606,47 +2038,29 @@ bool LoadScene()
 
 			char* targetName = controller->joints->dataName[jointID];
 
-			unsigned subID = 0;
+			unsigned subID = unsigned(global.nodes.size());
 
-			while(subID < global.nodes.size())
+			auto candidates = sidNodes.find(targetName);
+
+			if(candidates != sidNodes.end())
 			{
-				// Found a match
-				if(global.nodes[subID].sid != NULL && strcmp(global.nodes[subID].sid, targetName) == 0)
+				for(unsigned k = 0; k < candidates->second.size() && subID == global.nodes.size(); k++)
 				{
+					unsigned candidate = candidates->second[k];
+
 					if(cSkel.rootNames.empty())
-						break;
+						subID = candidate;
 
 					// Check that this is a valid sub-tree
-					auto &node = global.nodes[subID];
-
-					bool valid = false;
-
-					for(;;)
+					for(unsigned r = 0; r < rootNodes.size(); r++)
 					{
-						for(unsigned k = 0; k < cSkel.rootNames.size(); k++)
+						if(candidate >= rootNodes[r] && candidate < global.nodes[rootNodes[r]].subtreeEnd)
 						{
-							if(strcmp(cSkel.rootNames[k], node.ID) == 0)
-							{
-								valid = true;
-								break;
-							}
-						}
-
-						if(valid)
-							break;
-
-						// Check parent
-						if(node.parentNodeID != -1)
-							node = global.nodes[node.parentNodeID];
-						else
+							subID = candidate;
 							break;
+						}
 					}
-
-					if(valid)
-						break;
 				}
-
-				subID++;
 			}
 
 			if(subID == global.nodes.size())
@@ -1658,24 +2072,24 @@ bool LoadScene()
 				return false;
 			}
 
-			cSkel.nodeIDs[n] = subID;
+			global.jointNodes[cSkel.firstJoint + n] = subID;
 			LogOptional("Skeleton %d, found joint %s at %d\r\n", i, targetName, subID);
 
 			cSkel.bindShapeMat = controller->bindMat;
-			cSkel.bindMat[n] = mat4(&controller->binds->dataFloat[jointID * 16]).transpose() * cSkel.bindShapeMat;
+			global.jointBindMat[cSkel.firstJoint + n] = mat4(&controller->binds->dataFloat[jointID * 16]).transpose() * cSkel.bindShapeMat;
+
+			jointCount++;
 		}
 	}
 
-	// Find out the list of nodes that require animation
-	struct TransformBlock
-	{
-		DAETransformBlock block;
-		unsigned count;
-	};
+	LogPrint("%dms to bind %d joints of %d skeletons\r\n", clock() - bindStartTime, jointCount, global.skeletons.size());
+	LogPrint("%d bytes in skeletons, %d bytes in joints\r\n", unsigned(sizeof(DAESkeleton) * global.skeletons.size()), unsigned((sizeof(uint32_t) + sizeof(mat4)) * global.jointNodes.size()));
 
+	// Find out the list of nodes that require animation
 	global.animatedNodes.clear();
 
-	std::vector<TransformBlock> idleMat;
+	std::vector<TransformBlock> &idleMat = sampler.idleMat;
+	idleMat.clear();
 
 	double startTime = 1e6;
 	double longestAnim = 0.0;
@@ -1684,16 +2098,7 @@ bool LoadScene()
 	{
 		auto &anim = anims[i];
 
-		unsigned targetNode = -1;
-
-		for(unsigned n = 0; n < global.nodes.size(); n++)
-		{
-			if(strcmp(global.nodes[n].ID, anim->targetNode) == 0)
-			{
-				targetNode = n;
-				break;
-			}
-		}
+		unsigned targetNode = global.symbols.Find(SYM_NODE, anim->targetNode);
 
 		if(targetNode == -1)
 		{
@@ -1725,31 +2130,14 @@ bool LoadScene()
 		if(anim->outSource->isConstant)
 		{
 			mat4 model;
+			model.identity();
 
 			// Calculate matrices
 			for(unsigned n = 0; n < target.tCount; n++)
 			{
 				mat4 tempTransform;
 
-				switch(target.tForm[n].type)
-				{
-				case DT_MATRIX:
-					memcpy(&tempTransform.mat[0], target.tForm[n].data, 16 * sizeof(float));
-					tempTransform = tempTransform.transpose();
-					break;
-				case DT_ROTATE:
-					tempTransform.rotate(vec3(target.tForm[n].data), target.tForm[n].data[3]);
-					break;
-				case DT_TRANSLATE:
-					tempTransform.translate(vec3(target.tForm[n].data));
-					break;
-				case DT_SCALE:
-					tempTransform.scale(vec3(target.tForm[n].data));
-					break;
-				case DT_LOOKAT:
-				case DT_SKEW:
-					break;
-				}
+				CalculateTransform(tempTransform, global.transforms[target.firstTransform + n]);
 
 				model *= tempTransform;
 			}
@@ -1778,7 +2166,8 @@ bool LoadScene()
 			idleMat.push_back(TransformBlock());
 			idleMat.back().count = target.tCount;
 
-			memcpy(idleMat.back().block, target.tForm, sizeof(DAETransformBlock));
+			for(unsigned n = 0; n < target.tCount; n++)
+				idleMat.back().block[n] = global.transforms[target.firstTransform + n];
 		}
 		else
 		{
@@ -1787,46 +2176,153 @@ bool LoadScene()
 
 		auto &inTime = anim->inSource->dataFloat;
 
-		LogOptional("Animation (%s) for node (%s) at %d (%f-%f)\r\n", anim->ID, anim->targetNode, anim->targetNodePos, inTime.front(), inTime.back());
+		LogOptional("Animation (%s) for node (%s) at %d (%f-%f)\r\n", anim->ID, anim->targetNode, anim->targetNodePos, inTime[0], inTime[anim->inSource->count * anim->inSource->stride - 1]);
 
 		startTime = startTime < inTime[0] ? startTime : inTime[0];
 		longestAnim = longestAnim > inTime[anim->dataCount - 1] ? longestAnim : inTime[anim->dataCount - 1];
 
 		anim->lastSample = 0;
+
+		// Find transformation element that is changed by the animation
+		anim->targetPart = ~0u;
+
+		for(unsigned k = 0; k < target.tCount; k++)
+		{
+			const DAETransform &transform = global.transforms[target.firstTransform + k];
+
+			if(transform.sid && strcmp(transform.sid, anim->targetSID) == 0)
+			{
+				anim->targetPart = k;
+				break;
+			}
+		}
+
+		if(anim->targetPart == ~0u)
+		{
+			anim->skip = true;
+
+			LogOptional("\tTarget sid (%s) issued by animation (%s) wasn't found\r\n", anim->targetSID, anim->ID);
+		}
+	}
+
+	// Split transformation elements of every animated node into the static and animated ones
+	std::vector<TransformState> &idleState = sampler.idleState;
+	idleState.resize(idleMat.size());
+
+	for(unsigned i = 0; i < idleMat.size(); i++)
+	{
+		auto &state = idleState[i];
+
+		for(unsigned n = 0; n < idleMat[i].count; n++)
+			state.isAnimated[n] = false;
+	}
+
+	for(unsigned i = 0; i < anims.size(); i++)
+	{
+		if(!anims[i]->skip)
+			idleState[anims[i]->targetNodePos].isAnimated[anims[i]->targetPart] = true;
 	}
 
-	TransformBlock *tempCopy = new TransformBlock[idleMat.size()];
-	mat4 *targetMat = new mat4[idleMat.size()];
+	unsigned totalElementCount = 0;
+	unsigned animatedElementCount = 0;
+
+	for(unsigned i = 0; i < idleMat.size(); i++)
+	{
+		auto &state = idleState[i];
+		auto &idle = idleMat[i];
+
+		state.firstAnimated = idle.count;
+		state.lastAnimated = 0;
+
+		for(unsigned n = 0; n < idle.count; n++)
+		{
+			if(!state.isAnimated[n])
+				continue;
+
+			state.firstAnimated = state.firstAnimated < n ? state.firstAnimated : n;
+			state.lastAnimated = n;
+
+			animatedElementCount++;
+		}
+
+		totalElementCount += idle.count;
+
+		state.prefix.identity();
+		state.suffix.identity();
+
+		mat4 tempTransform;
+
+		for(unsigned n = 0; n < idle.count; n++)
+		{
+			CalculateTransform(tempTransform, idle.block[n]);
+
+			if(n < state.firstAnimated)
+				state.prefix *= tempTransform;
+			else if(n > state.lastAnimated)
+				state.suffix *= tempTransform;
+			else if(!state.isAnimated[n])
+				state.constant[n] = tempTransform;
+		}
+	}
 
-	double step = 1.0 / 30.0;
+	sampler.tempCopy = idleMat;
 
-	unsigned sampleCount = 0;
-	mat4 *result = NULL;
+	sampler.nextFrame = 0;
+	sampler.sampleTime = 0;
 
 	if(startTime < 0.0)
 		startTime = 0.0;
 
+	sampler.startTime = startTime;
+
+	unsigned frame = 0;
+
 	if(startTime < longestAnim)
 	{
-		LogPrint("Sampling animation in a period of [%f, %f] with a %f second step\r\n", startTime, longestAnim, step);
-
-		sampleCount = int((longestAnim - startTime) / step + 1);
+		LogPrint("Sampling animation in a period of [%f, %f] with a %f second step\r\n", startTime, longestAnim, sampler.step);
+		LogPrint("%d out of %d transformation elements are animated\r\n", animatedElementCount, totalElementCount);
 
-		result = new mat4[idleMat.size() * sampleCount];
+		while(startTime + frame * sampler.step < longestAnim)
+			frame++;
 
-		LogPrint("Result size is %d (%d bytes)\r\n", sampleCount, sizeof(mat4) * idleMat.size() * sampleCount);
+		LogPrint("Result size is %d (%d bytes sampled a window at a time)\r\n", frame, sizeof(mat4) * idleMat.size() * frame);
 	}
 
-	std::vector<float> dummySource;
+	global.animSampleCount = frame - 1;
+	global.animSampleStep = sampler.step;
 
-	unsigned frame = 0;
+	return true;
+}
 
-	while(startTime + frame * step < longestAnim)
+void SampleAnimation(unsigned firstFrame, unsigned frameCount, mat4 *target)
+{
+	unsigned samplingStartTime = clock();
+
+	std::vector<TransformBlock> &idleMat = sampler.idleMat;
+	std::vector<TransformState> &idleState = sampler.idleState;
+
+	std::vector<TransformBlock> &tempCopy = sampler.tempCopy;
+
+	// Animation cursors only move forward
+	if(firstFrame < sampler.nextFrame)
+	{
+		for(unsigned i = 0; i < anims.size(); i++)
+			anims[i]->lastSample = 0;
+	}
+
+	for(unsigned frame = firstFrame; frame < firstFrame + frameCount; frame++)
 	{
-		double currTime = startTime + frame * step;
+		double currTime = sampler.startTime + frame * sampler.step;
 
-		// copy idle transformation
-		memcpy(tempCopy, &idleMat[0], sizeof(TransformBlock) * idleMat.size());
+		// copy idle transformation of the animated elements
+		for(unsigned i = 0; i < idleMat.size(); i++)
+		{
+			for(unsigned n = idleState[i].firstAnimated; n <= idleState[i].lastAnimated && n < idleMat[i].count; n++)
+			{
+				if(idleState[i].isAnimated[n])
+					tempCopy[i].block[n] = idleMat[i].block[n];
+			}
+		}
 
 		// now, every animation will make changes to transformation state
 		for(unsigned i = 0; i < anims.size(); i++)
@@ -1836,8 +2332,8 @@ bool LoadScene()
 			if(anim.skip)
 				continue;
 
-			auto inTime = anim.inSource ? anim.inSource->dataFloat : dummySource;
-			auto outValues = anim.outSource ? anim.outSource->dataFloat : dummySource;
+			auto &inTime = anim.inSource->dataFloat;
+			auto &outValues = anim.outSource->dataFloat;
 
 			DAESource *inTangent = anim.inTangentSource;
 			DAESource *outTangent = anim.outTangentSource;
@@ -1847,7 +2343,7 @@ bool LoadScene()
 
 			double mix = 0.0;
 			
-			if(anim.lastSample + 1 < inTime.size())
+			if(anim.lastSample + 1 < anim.inSource->count * anim.inSource->stride)
 			{
 				mix = (currTime - inTime[anim.lastSample]) / (inTime[anim.lastSample + 1] - inTime[anim.lastSample]);
 			}
@@ -1861,22 +2357,7 @@ bool LoadScene()
 			if(mix < 0.0)
 				mix = 0.0;
 
-			unsigned targetPart = -1;
-
-			for(unsigned k = 0; k < tempCopy[anim.targetNodePos].count; k++)
-			{
-				if(tempCopy[anim.targetNodePos].block[k].sid && strcmp(tempCopy[anim.targetNodePos].block[k].sid, anim.targetSID) == 0)
-				{
-					targetPart = k;
-					break;
-				}
-			}
-
-			if(targetPart == -1)
-			{
-				LogOptional("\tTarget sid (%s) issued by animation (%s) wasn't found\r\n", anims[i]->targetSID, anims[i]->ID);
-				continue;
-			}
+			unsigned targetPart = anim.targetPart;
 
 			// Change target data
 			unsigned outStride = anim.outSource->stride;
@@ -1919,77 +2400,67 @@ bool LoadScene()
 			}
 		}
 
-		// Clear matrices
-		for(unsigned i = 0; i < idleMat.size(); i++)
-			targetMat[i].identity();
-
 		mat4 tempTransform;
 
-		// Calculate matrices
+		// Calculate matrices, only the animated elements are evaluated
 		for(unsigned i = 0; i < idleMat.size(); i++)
 		{
-			for(unsigned n = 0; n < tempCopy[i].count; n++)
+			auto &state = idleState[i];
+
+			mat4 &result = target[(frame - firstFrame) * idleMat.size() + i];
+
+			result = state.prefix;
+
+			for(unsigned n = state.firstAnimated; n <= state.lastAnimated && n < tempCopy[i].count; n++)
 			{
-				tempTransform.identity();
+				if(state.isAnimated[n])
+				{
+					CalculateTransform(tempTransform, tempCopy[i].block[n]);
 
-				switch(tempCopy[i].block[n].type)
+					result *= tempTransform;
+				}
+				else
 				{
-				case DT_MATRIX:
-					memcpy(&tempTransform.mat[0], tempCopy[i].block[n].data, 16 * sizeof(float));
-					tempTransform = tempTransform.transpose();
-					break;
-				case DT_ROTATE:
-					tempTransform.rotate(vec3(tempCopy[i].block[n].data), tempCopy[i].block[n].data[3]);
-					break;
-				case DT_TRANSLATE:
-					tempTransform.translate(vec3(tempCopy[i].block[n].data));
-					break;
-				case DT_SCALE:
-					tempTransform.scale(vec3(tempCopy[i].block[n].data));
-					break;
-				case DT_LOOKAT:
-				case DT_SKEW:
-					break;
+					result *= state.constant[n];
 				}
-
-				targetMat[i] *= tempTransform;
 			}
-		}
 
-		assert(frame < sampleCount);
-
-		for(unsigned i = 0; i < idleMat.size(); i++)
-			result[frame * idleMat.size() + i] = targetMat[i];
-
-		frame++;
+			result *= state.suffix;
+		}
 	}
 
-	global.matrixAnimation = result;
-	global.animSampleCount = frame - 1;
-
-	return true;
+	sampler.nextFrame = firstFrame + frameCount;
+	sampler.sampleTime += clock() - samplingStartTime;
 }
 
-void SaveToBlob(std::vector<unsigned char> &blob, void* data, unsigned size)
+size_t AlignOffset(size_t offset, size_t alignment)
 {
-	blob.insert(blob.end(), (unsigned char*)data, (unsigned char*)data + size);
+	return (offset + alignment - 1) / alignment * alignment;
 }
 
-void SaveGeometry(char* folderNameOut)
+void SaveGeometry(char* folderNameOut, ArchiveWriter *archive)
 {
 	// Find, what geometry have a skin attached to it, and create geometry index indirection map
-	bool *hasController = new bool[global.geoms.size()];
-
-	for(unsigned i = 0; i < global.geoms.size(); i++)
-		hasController[i] = false;
+	std::vector<unsigned> geometryController(global.geoms.size(), ~0u);
 
 	for(unsigned i = 0; i < global.contrls.size(); i++)
-		hasController[global.contrls[i]->geometryID] = true;
+	{
+		unsigned geometryID = global.contrls[i]->geometryID;
+
+		if(geometryID < global.geoms.size() && geometryController[geometryID] == ~0u)
+			geometryController[geometryID] = i;
+	}
 
 	LogPrint("Saving geometry\r\n");
 
 	global.geometryIDs = new const char*[global.geoms.size()];
 
+	unsigned startTime = clock();
+	uint64_t totalSize = 0;
+
+	unsigned pooledCount = 0;
+
+	// Whole file is prepared in a single buffer that is reused for every geometry
 	std::vector<unsigned char> blob;
 
 	for(unsigned n = 0; n < global.geoms.size(); n++)
@@ -1998,104 +2469,204 @@ void SaveGeometry(char* folderNameOut)
 
 		Export::GeometryInfo target;
 
-		blob.clear();
+		unsigned c = geometryController[n];
 
-		bool withController = hasController[n];
+		bool withController = c != ~0u;
 
 		if(withController)
 			LogOptional("  Saving dynamic geometry %s\r\n", source->name);
 		else
 			LogOptional("  Saving static geometry %s\r\n", source->name);
 
-		target.version = 1;
+		target.version = global.options.geometryVersion;
 		target.formatComponents = withController ? 6 : 4;
 		target.vertexCount = source->VB.size();
-		target.vertexSize = withController ? sizeof(Vertex) + 12 : sizeof(Vertex);
+		target.vertexSize = withController ? SkinnedVertexSize : sizeof(Vertex);
 		target.indexCount = source->IB.size();
 		target.indexSize = 2;
 		target.bounds = source->bounds;
 
-		// Save geometry info
-		SaveToBlob(blob, &target, sizeof(target));
+		unsigned staticFormat[] = { Export::FCT_FLOAT3,
+									Export::FCT_INT16_2N,
+									Export::FCT_INT16_4N,
+									Export::FCT_END };
 
-		// Save format
-		if(withController)
-		{
-			unsigned format[] = { Export::FCT_FLOAT3,
+		unsigned skinnedFormat[] = { Export::FCT_FLOAT3,
 									Export::FCT_INT16_2N,
 									Export::FCT_INT16_4N,
 									Export::FCT_INT16_4N,
 									Export::FCT_UINT8_4,
 									Export::FCT_END };
 
-			SaveToBlob(blob, format, sizeof(format));
-		}
-		else
+		unsigned *format = withController ? skinnedFormat : staticFormat;
+		size_t formatSize = withController ? sizeof(skinnedFormat) : sizeof(staticFormat);
+
+		size_t vertexDataSize = size_t(target.vertexCount) * target.vertexSize;
+		size_t indexDataSize = size_t(target.indexCount) * target.indexSize;
+
+		size_t formatOffset = sizeof(target);
+		size_t vertexOffset = formatOffset + formatSize;
+		size_t indexOffset = vertexOffset + vertexDataSize;
+		size_t fileSize = indexOffset + indexDataSize;
+
+		Export::GeometryLayout layout;
+
+		// Sections of version 2 are aligned, so that a mapped file can be used in place
+		if(target.version == 2)
 		{
-			unsigned format[] = { Export::FCT_FLOAT3,
-									Export::FCT_INT16_2N,
-									Export::FCT_INT16_4N,
-									Export::FCT_END };
+			formatOffset = sizeof(target) + sizeof(layout);
+			vertexOffset = AlignOffset(formatOffset + AlignOffset(formatSize, 16), Export::GeometryPageSize);
+			indexOffset = vertexOffset + AlignOffset(vertexDataSize, Export::GeometryPageSize);
+			fileSize = indexOffset + AlignOffset(indexDataSize, Export::GeometryPageSize);
+
+			layout.pageSize = Export::GeometryPageSize;
+			layout.reserved = 0;
+			layout.vertexDataOffset = vertexOffset;
+			layout.indexDataOffset = indexOffset;
+			layout.fileSize = fileSize;
+		}
+
+		blob.resize(fileSize);
+
+		unsigned char *data = blob.data();
 
-			SaveToBlob(blob, format, sizeof(format));
+		// Buffer is reused, padding has to be cleared
+		if(target.version == 2)
+		{
+			memset(data + formatOffset + formatSize, 0, vertexOffset - formatOffset - formatSize);
+			memset(data + vertexOffset + vertexDataSize, 0, indexOffset - vertexOffset - vertexDataSize);
+			memset(data + indexOffset + indexDataSize, 0, fileSize - indexOffset - indexDataSize);
 		}
 
+		// Save geometry info and format
+		memcpy(data, &target, sizeof(target));
+
+		if(target.version == 2)
+			memcpy(data + sizeof(target), &layout, sizeof(layout));
+
+		memcpy(data + formatOffset, format, formatSize);
+
 		// Save vertices
 		if(withController)
 		{
-			// Find controller
-			unsigned c;
-			for(c = 0; c < global.contrls.size(); c++)
-			{
-				if(global.contrls[c]->geometryID == n)
-					break;
-			}
-
 			LogOptional("   Geometry controller %d\r\n", c);
 
-			for(unsigned k = 0; k < source->VB.size(); k++)
-			{
-				SaveToBlob(blob, &source->VB[k], sizeof(Vertex));
-
-				// Save 4 bone weights
-				SaveToBlob(blob, &global.contrls[c]->exWeights[(source->posIndex[k]) * 4], 8);
-
-				// Save 4 bone indices
-				SaveToBlob(blob, &global.contrls[c]->exIndices[(source->posIndex[k]) * 4], 4);
-			}
+			InterleaveSkinnedVertices(data + vertexOffset, source->VB.data(), source->posIndex.data(), target.vertexCount, global.contrls[c]->exWeights, global.contrls[c]->exIndices);
 		}
-		else
+		else if(!source->VB.empty())
 		{
-			SaveToBlob(blob, &source->VB[0], sizeof(source->VB[0]) * source->VB.size());
+			memcpy(data + vertexOffset, source->VB.data(), sizeof(source->VB[0]) * source->VB.size());
 		}
 
 		// Saving indices
-		SaveToBlob(blob, &source->IB[0], sizeof(source->IB[0]) * source->IB.size());
+		if(!source->IB.empty())
+			memcpy(data + indexOffset, source->IB.data(), sizeof(source->IB[0]) * source->IB.size());
 
 		// Compute hash
 		global.geometryIDs[n] = source->ID;
 
 		// Save file
-		char buf[128];
-		sprintf(buf, "%s/%s.bgi", folderNameOut, source->ID);
+		char buf[512];
+
+		if(global.options.geometryPool)
+		{
+			// Pooled geometry is named by its contents, so a mesh shared by many scenes is stored once
+			sprintf(buf, "%016llx", (unsigned long long)HashData(data, fileSize, 14695981039346656037ull));
+
+			global.geometryIDs[n] = arena.Duplicate(buf);
+
+			sprintf(buf, "%s/%s.bgi", global.options.geometryPool, global.geometryIDs[n]);
+
+			if(FILE *fIn = fopen(buf, "rb"))
+			{
+				fclose(fIn);
+				pooledCount++;
+			}
+			else if(!SaveOutputFile(buf, data, fileSize))
+			{
+				global.outputFailed = true;
+			}
+
+			// Meshes of the scene may have the same contents
+			if(std::find(global.pooledFiles.begin(), global.pooledFiles.end(), buf) == global.pooledFiles.end())
+				global.pooledFiles.push_back(buf);
+
+			LogOptional("   Geometry %s is pooled as %s\r\n", source->ID, global.geometryIDs[n]);
+		}
+		else if(archive)
+		{
+			sprintf(buf, "%s.bgi", source->ID);
 
-		if(FILE *fOut = fopen(buf, "wb"))
+			if(!AddArchiveEntry(*archive, buf, data, fileSize, target.version == 2 ? Export::GeometryPageSize : Export::MeshSectionAlignment))
+			{
+				LogPrint("Failed to add '%s' to the archive\r\n", buf);
+				global.outputFailed = true;
+			}
+		}
+		else
 		{
-			fwrite(blob.data(), 1, blob.size(), fOut);
-			fclose(fOut);
+			sprintf(buf, "%s/%s.bgi", folderNameOut, source->ID);
+
+			if(SaveOutputFile(buf, data, fileSize))
+				global.outputFiles.push_back(buf);
+			else
+				global.outputFailed = true;
 		}
+
+		totalSize += fileSize;
 	}
 
-	delete[] hasController;
+	unsigned saveTime = clock() - startTime;
+
+	LogPrint("%dms to save %d geometries (%d KB, %.1f MB/s)\r\n", saveTime, unsigned(global.geoms.size()), unsigned(totalSize / 1024), saveTime ? double(totalSize) / (1024.0 * 1024.0) / (saveTime / 1000.0) : 0.0);
+
+	if(global.options.geometryPool)
+		LogPrint("%d of %d geometries were already in the pool\r\n", pooledCount, unsigned(global.geoms.size()));
 }
 
-void SaveNode(char* fileNameOut, unsigned node, Context &global);
+void SaveNodes(std::vector<ExportTarget> &targets, Context &global, ArchiveWriter *archive);
 
 void SaveFile(char* fileNameOut, char* folderNameOut)
 {
-	SaveGeometry(folderNameOut);
+	// Packed scene is saved next to the object file, under the same name
+	// Archive is completed under a temporary name, then replaces the previous one if it changed
+	ArchiveWriter archiveWriter;
+	ArchiveWriter *archive = NULL;
+
+	char archiveName[512];
+	char archiveTempName[512];
+
+	if(global.options.pack)
+	{
+		strcpy(archiveName, fileNameOut);
+
+		if(char *ext = strrchr(archiveName, '.'))
+			*ext = 0;
+
+		strcat(archiveName, ".bpk");
+
+		sprintf(archiveTempName, "%s.part", archiveName);
+
+		// Loose files are not what was asked for, nothing is saved without the archive
+		if(!BeginArchive(archiveWriter, archiveTempName))
+		{
+			outputStats.failed++;
+			global.outputFailed = true;
+			return;
+		}
+
+		archive = &archiveWriter;
+	}
+
+	SaveGeometry(folderNameOut, archive);
+
+	std::vector<ExportTarget> targets;
 
-	SaveNode(fileNameOut, -1, global);
+	ExportTarget scene;
+	strcpy(scene.fileName, fileNameOut);
+	scene.nodeID = -1;
+
+	targets.push_back(scene);
 
 	for(unsigned i = 0; i < global.nodes.size(); i++)
 	{
@@ -2117,66 +2688,191 @@ void SaveFile(char* fileNameOut, char* folderNameOut)
 		LogOptional(" Saving stand-alone object '%s' node %d\r\n", name, i);
 
 		// Save file
-		char buf[128];
-		sprintf(buf, "%s/%s.bmi", folderNameOut, name);
+		ExportTarget object;
+		sprintf(object.fileName, "%s/%s.bmi", folderNameOut, name);
+		object.nodeID = i;
 
-		SaveNode(buf, i, global);
+		targets.push_back(object);
 	}
 
+	// All objects are saved together, so that every animation frame is sampled only once
+	SaveNodes(targets, global, archive);
+
+	if(archive)
+	{
+		if(!EndArchive(*archive))
+		{
+			LogPrint("Failed to save '%s'\r\n", archiveName);
+
+			remove(archiveTempName);
+
+			outputStats.failed++;
+			global.outputFailed = true;
+		}
+		else if(CommitOutputFile(archiveTempName, archiveName))
+		{
+			global.outputFiles.push_back(archiveName);
+		}
+		else
+		{
+			global.outputFailed = true;
+		}
+	}
+
+	LogPrint("%dms to sample %d frames of %d animated nodes\r\n", sampler.sampleTime, global.animSampleCount == -1 ? 0 : global.animSampleCount, global.animatedNodes.size());
+
 	delete[] global.geometryIDs;
 }
 
 void FreeData()
 {
 	for(unsigned i = 0, l = unsigned(global.geoms.size()); i != l; i++)
-	{
 		global.geoms[i]->Free();
-		delete global.geoms[i];
-	}
+
 	delete[] data;
+	data = NULL;
+
+	LogPrint("%d parse-time allocations (%d bytes) were served by %d arena blocks\r\n", arena.allocationCount, unsigned(arena.allocationSize), arena.BlockCount());
+
+	// Everything below points into the arena or the document of the converted file
+	global.geoms.clear();
+	global.contrls.clear();
+	global.nodes.clear();
+	global.skeletons.clear();
+	global.transforms.clear();
+	global.jointNodes.clear();
+	global.jointBindMat.clear();
+	global.animatedNodes.clear();
+	global.images.clear();
+	global.effects.clear();
+	global.materials.clear();
+	global.outputFiles.clear();
+	global.pooledFiles.clear();
+	global.outputFailed = false;
+	global.geometryIDs = NULL;
+
+	anims.clear();
+	animSource.clear();
+
+	arena.Reset();
 }
 
 bool ProcessFile(char* fileNameIn, char* fileNameOut, char* folderNameOut)
 {
+	global.options = options;
+
 	unsigned firstTime, startTime = firstTime = clock();
 	if(!LoadFile(fileNameIn))
 		return false;
 	unsigned fileTime = clock() - startTime;
 
+	LogMemoryUsage("file reading");
+
+	// Input that was converted before with the same options is restored from the cache
+	uint64_t cacheKey = 0;
+
+	if(cache.enabled)
+	{
+		startTime = clock();
+
+		const char *sceneName = strrchr(fileNameOut, '/');
+
+		cacheKey = ConversionKey(data, fsize, sceneName ? sceneName + 1 : fileNameOut, global.options);
+
+		if(RestoreCachedOutputs(cache, cacheKey, folderNameOut, global.options.geometryPool))
+		{
+			LogPrint("%dms to restore cached conversion %016llx\r\n", clock() - startTime, (unsigned long long)cacheKey);
+
+			delete[] data;
+			data = NULL;
+
+			return true;
+		}
+
+		LogPrint("%dms to look up cached conversion %016llx\r\n", clock() - startTime, (unsigned long long)cacheKey);
+	}
+
+	global.symbols.Clear();
+	nodeNames.Clear();
+
 	startTime = clock();
 	ParseFile(data);
 	unsigned parseTime = clock() - startTime;
 
+	// Document keeps its own copy of the text
+	delete[] data;
+	data = NULL;
+
+	LogMemoryUsage("parsing");
+
 	startTime = clock();
 	LoadMaterialLibrary();
 	unsigned materialTime = clock() - startTime;
 
+	LogMemoryUsage("effect load");
+
 	startTime = clock();
 	LoadAnimationLibrary();
 	unsigned animTime = clock() - startTime;
 
+	LogMemoryUsage("animation load");
+
 	startTime = clock();
 	LoadGeometryLibrary();
+	CollapseDuplicateGeometry();
 	unsigned dataloadTime = clock() - startTime;
 
+	LogMemoryUsage("geometry load");
+
 	startTime = clock();
 	CreateIBVB();
 	unsigned vbibTime = clock() - startTime;
 
+	// Index groups are only needed to build vertex and index buffers
+	for(unsigned i = 0; i < global.geoms.size(); i++)
+		global.geoms[i]->FreeIndices();
+
+	LogMemoryUsage("VB IB creation");
+
 	startTime = clock();
 	LoadControllerLibrary();
 	unsigned skinTime = clock() - startTime;
 
+	// Controllers are the last to read source positions
+	for(unsigned i = 0; i < global.geoms.size(); i++)
+		global.geoms[i]->FreeStreams();
+
+	LogMemoryUsage("skin load");
+
 	startTime = clock();
 	bool sceneLoaded = LoadScene();
 	if(!sceneLoaded)
+	{
+		doc.reset();
+		FreeData();
 		return false;
+	}
 	unsigned nodeTime = clock() - startTime;
 
+	// Scene is the last consumer of the document, all names were copied
+	doc.reset();
+
+	LogMemoryUsage("scene load");
+
 	startTime = clock();
 	SaveFile(fileNameOut, folderNameOut);
 	unsigned saveTime = clock() - startTime;
 
+	// Incomplete set of outputs would be restored as a complete conversion
+	bool saved = !global.outputFailed;
+
+	if(cache.enabled && saved)
+		StoreCachedOutputs(cache, cacheKey, global.outputFiles, global.pooledFiles);
+	else if(cache.enabled)
+		LogPrint("Conversion %016llx is not cached, some outputs were not saved\r\n", (unsigned long long)cacheKey);
+
+	LogMemoryUsage("saving");
+
 	startTime = clock();
 	FreeData();
 
@@ -2185,15 +2881,85 @@ bool ProcessFile(char* fileNameIn, char* fileNameOut, char* folderNameOut)
 	LogPrint("%dms to parse animations, %dms to parse skin info, %dms to parse nodes, %dms to save the file\r\n", animTime, skinTime, nodeTime, saveTime);
 	LogPrint("%dms to parse effects, %dms All\r\n", materialTime, clock() - firstTime);
 
-	return true;
+	return saved;
 }
 
+void RunKernelBenchmark(unsigned boneCount, unsigned iterations);
+void RunGeometryLoadBenchmark(const char *path, unsigned iterations);
+void RunObjectLoadBenchmark(const char *path, unsigned iterations);
+
 int main(unsigned argc, char** argv)
 {
 	logFile = fopen("log.txt", "wb");
 
 	for(unsigned i = 1; i < argc; i++)
 	{
+		// Options apply to the files that follow them
+		if(argv[i][0] == '-')
+		{
+			if(strcmp(argv[i], "-chunk") == 0 && i + 1 < argc)
+			{
+				options.animChunkDuration = atof(argv[++i]);
+
+				LogPrint("Animation is split into chunks of %f seconds\r\n", options.animChunkDuration);
+			}
+			else if(strcmp(argv[i], "-namehashes") == 0)
+			{
+				options.nameHashes = true;
+
+				LogPrint("Name hashes are saved\r\n");
+			}
+			else if(strcmp(argv[i], "-bgi2") == 0)
+			{
+				options.geometryVersion = 2;
+
+				LogPrint("Geometry is saved with page-aligned sections\r\n");
+			}
+			else if(strcmp(argv[i], "-bmi5") == 0)
+			{
+				options.objectVersion = 5;
+
+				LogPrint("Objects are saved with a section table\r\n");
+			}
+			else if(strcmp(argv[i], "-pack") == 0)
+			{
+				options.pack = true;
+
+				LogPrint("Geometry and objects are saved into one archive per scene\r\n");
+			}
+			else if(strcmp(argv[i], "-pool") == 0 && i + 1 < argc)
+			{
+				options.geometryPool = argv[++i];
+
+				LogPrint("Geometry is saved to the pool in %s\r\n", options.geometryPool);
+			}
+			else if(strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+			{
+				strcpy(cache.folder, argv[++i]);
+				cache.enabled = true;
+
+				LogPrint("Conversions are cached in %s\r\n", cache.folder);
+			}
+			else if(strcmp(argv[i], "-benchgeometry") == 0 && i + 1 < argc)
+			{
+				RunGeometryLoadBenchmark(argv[++i], 100);
+			}
+			else if(strcmp(argv[i], "-benchobject") == 0 && i + 1 < argc)
+			{
+				RunObjectLoadBenchmark(argv[++i], 100);
+			}
+			else if(strcmp(argv[i], "-benchkernels") == 0)
+			{
+				RunKernelBenchmark(256, 10000);
+			}
+			else
+			{
+				LogPrint("Unknown option %s, skipping\r\n", argv[i]);
+			}
+
+			continue;
+		}
+
 		LogPrint("Processing %s ...\r\n", argv[i]);
 
 		if(strstr(argv[i], ".dae") == NULL && strstr(argv[i], ".DAE") == NULL)
@@ -2236,6 +3002,11 @@ int main(unsigned argc, char** argv)
 		ProcessFile(argv[i], newName, folder);
 	}
 
+	if(cache.enabled)
+		LogPrint("Conversion cache: %d hits, %d misses\r\n", cache.hits, cache.misses);
+
+	LogPrint("Output files: %d rewritten, %d unchanged, %d failed\r\n", outputStats.written, outputStats.unchanged, outputStats.failed);
+
 	fclose(logFile);
 	return 0;
 }
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include <cstdint>
+
+#include <vector>
+
+#include "output.h"
+
+void LogPrint(const char* format, ...);
+
+bool FileSeek(FILE *file, uint64_t pos);
+uint64_t FileTell(FILE *file);
+
+OutputStats outputStats;
+
+uint64_t FileSize(FILE *file)
+{
+	fseek(file, 0, SEEK_END);
+
+	uint64_t size = FileTell(file);
+
+	FileSeek(file, 0);
+
+	return size;
+}
+
+// Existing file has to be read either way, so it is compared directly instead of through a hash
+bool SameContents(const char *path, const void *data, size_t size)
+{
+	FILE *fIn = fopen(path, "rb");
+
+	if(!fIn)
+		return false;
+
+	bool same = FileSize(fIn) == size;
+
+	std::vector<char> buffer(1 << 20);
+
+	for(size_t offset = 0; same && offset < size;)
+	{
+		size_t part = size - offset < buffer.size() ? size - offset : buffer.size();
+
+		same = fread(buffer.data(), 1, part, fIn) == part && memcmp(buffer.data(), (const char*)data + offset, part) == 0;
+
+		offset += part;
+	}
+
+	fclose(fIn);
+
+	return same;
+}
+
+bool SameFiles(const char *lhsPath, const char *rhsPath)
+{
+	FILE *lhs = fopen(lhsPath, "rb");
+	FILE *rhs = fopen(rhsPath, "rb");
+
+	bool same = lhs && rhs && FileSize(lhs) == FileSize(rhs);
+
+	std::vector<char> lhsBuffer(same ? 1 << 20 : 0);
+	std::vector<char> rhsBuffer(same ? 1 << 20 : 0);
+
+	while(same)
+	{
+		size_t lhsRead = fread(lhsBuffer.data(), 1, lhsBuffer.size(), lhs);
+		size_t rhsRead = fread(rhsBuffer.data(), 1, rhsBuffer.size(), rhs);
+
+		same = lhsRead == rhsRead && memcmp(lhsBuffer.data(), rhsBuffer.data(), lhsRead) == 0;
+
+		if(lhsRead == 0)
+			break;
+	}
+
+	if(lhs)
+		fclose(lhs);
+
+	if(rhs)
+		fclose(rhs);
+
+	return same;
+}
+
+bool MoveOverFile(const char *from, const char *to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+bool CommitOutputFile(const char *tempName, const char *path)
+{
+	if(SameFiles(tempName, path))
+	{
+		remove(tempName);
+
+		outputStats.unchanged++;
+		return true;
+	}
+
+	if(!MoveOverFile(tempName, path))
+	{
+		LogPrint("Failed to replace '%s'\r\n", path);
+
+		remove(tempName);
+
+		outputStats.failed++;
+		return false;
+	}
+
+	outputStats.written++;
+	return true;
+}
+
+bool SaveOutputFile(const char *path, const void *data, size_t size)
+{
+	if(SameContents(path, data, size))
+	{
+		outputStats.unchanged++;
+		return true;
+	}
+
+	char tempName[512];
+	sprintf(tempName, "%s.part", path);
+
+	FILE *fOut = fopen(tempName, "wb");
+
+	bool saved = fOut && fwrite(data, 1, size, fOut) == size;
+
+	if(fOut)
+		saved &= fclose(fOut) == 0;
+
+	if(!saved || !MoveOverFile(tempName, path))
+	{
+		LogPrint("Failed to save '%s'\r\n", path);
+
+		remove(tempName);
+
+		outputStats.failed++;
+		return false;
+	}
+
+	outputStats.written++;
+	return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+// Output files are replaced with a rename once complete, a file that already has the same contents is left untouched
+struct OutputStats
+{
+	OutputStats(): written(0), unchanged(0), failed(0)
+	{
+	}
+
+	unsigned written;
+	unsigned unchanged;
+	unsigned failed;
+};
+
+extern OutputStats outputStats;
+
+bool SaveOutputFile(const char *path, const void *data, size_t size);
+
+// Temporary file is moved over the output, or removed if the output has the same contents
+bool CommitOutputFile(const char *tempName, const char *path);
+
+// Replaces the file in one step, readers see either the old or the new contents
+bool MoveOverFile(const char *from, const char *to);
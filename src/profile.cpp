@@ -0,0 +1,36 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+void LogPrint(const char* format, ...);
+
+// Kept apart from the converter sources, so that system headers don't leak into them
+void LogMemoryUsage(const char *stage)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		LogPrint("Memory after %s: %dKB, peak %dKB\r\n", stage, unsigned(counters.WorkingSetSize / 1024), unsigned(counters.PeakWorkingSetSize / 1024));
+#else
+	rusage usage;
+
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+		// Peak is reported in bytes on macOS and in kilobytes elsewhere
+#ifdef __APPLE__
+		unsigned peak = unsigned(usage.ru_maxrss / 1024);
+#else
+		unsigned peak = unsigned(usage.ru_maxrss);
+#endif
+
+		LogPrint("Memory after %s: peak %dKB\r\n", stage, peak);
+	}
+#endif
+}
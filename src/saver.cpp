@@ -4,14 +4,21 @@
 #include <stdarg.h>
 #include <time.h>
 
+#include <cassert>
+
 #include <algorithm>
+#include <unordered_map>
 
 #include "../pugixml/src/pugixml.hpp"
 
+#include "archive.h"
 #include "context.h"
 #include "export.h"
+#include "kernels.h"
+#include "output.h"
 
 void LogPrint(const char* format, ...);
+void SampleAnimation(unsigned firstFrame, unsigned frameCount, mat4 *target);
 
 #ifdef LOG_VERBOSE
 #define LogOptional LogPrint
@@ -19,114 +26,223 @@ void LogPrint(const char* format, ...);
 #define LogOptional(...) (void)0
 #endif
 
-unsigned AppendString(std::vector<char> &stringData, const char *str)
-{
-	unsigned offset = stringData.size();
+// Number of animation frames that are sampled and saved at once
+const unsigned AnimationWindowSize = 256;
 
-	stringData.insert(stringData.end(), str, str + strlen(str) + 1);
+// Animation key as it is kept in the spill file until the tracks are known
+struct AnimKeyRecord
+{
+	uint32_t track;
+	uint32_t frame;
 
-	return offset;
-}
+	mat4 value;
+};
 
-void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
+// Part of a spill file with a window of frames of a single object
+// aabb bounds[frameCount];
+// AnimKeyRecord keys[keyCount];
+struct SpillBlock
 {
-	ContextLocal local;
+	uint64_t offset;
 
-	// Redirection tables
+	unsigned frameCount;
+	unsigned keyCount;
+};
+
+// World transformations and bounds of the whole scene at a single frame, shared by all exported objects
+struct SceneFrameCache
+{
+	std::vector<unsigned> animRedirection;	// Index of the node in the list of animated nodes
+	std::vector<unsigned> rootNode;			// Top-level node of the node hierarchy
+	std::vector<unsigned> skeletonBoneOffset;	// Index of the first skeleton bone in boneBounds
+	std::vector<unsigned> geometryIndex;	// Index of the static geometry node in nodeBounds
+	std::vector<unsigned> geometryNodes;	// Nodes with static geometry
+	std::vector<unsigned> boneNodes;		// Joint nodes of all skeleton bones
+
+	// Redirection tables are shared by all exported objects, entries used by an object are reset when it is collected
 	std::vector<unsigned> parentRedirection;
 	std::vector<unsigned> skeletonRedirection;
 	std::vector<unsigned> effectRedirection;
+	std::vector<bool> isSkeletonRoot;
 
-	for(unsigned i = 0; i < global.nodes.size(); i++)
-		parentRedirection.push_back(~0u);
+	std::vector<mat4> world;
+	std::vector<aabb> nodeBounds;	// Bounds of the static geometry
+	std::vector<aabb> boneBounds;	// Bounds of the skeleton bones
 
-	for(unsigned i = 0; i < global.skeletons.size(); i++)
-		skeletonRedirection.push_back(~0u);
+	// Batches for the bounds kernels, local bounds and bind matrices do not change between frames
+	MatrixBatch geometryWorld;
+	BoundsBatch geometryLocal;
 
-	for(unsigned i = 0; i < global.effects.size(); i++)
-		effectRedirection.push_back(~0u);
+	MatrixBatch boneWorld;
+	MatrixBatch boneBind;
+	MatrixBatch boneMatrices;
+	BoundsBatch boneLocal;
+};
 
-	// Filter nodes and node data of interest
-	std::vector<unsigned> allowedRoots;
-	allowedRoots.push_back(nodeID);
+// String section of an object file, every string is stored once and offset 0 is the empty string
+struct StringTable
+{
+	StringTable()
+	{
+		data.push_back(0);
+		offsets[""] = 0;
+	}
+
+	std::vector<char> data;
+	std::unordered_map<std::string, unsigned> offsets;
+};
+
+// Exported object has its top-level nodes moved, so the cached bounds are moved with them
+struct BoundsSource
+{
+	unsigned index;
+	vec3 offset;
+};
+
+// Export state of a single object file
+struct NodeExport
+{
+	char fileName[512];
+	unsigned nodeID;
+
+	ContextLocal local;
+
+	std::vector<unsigned> animNodeRedirection;
+
+	std::vector<unsigned> globalNodes;
+
+	std::vector<Export::NodeInfo> nodeList;
+	std::vector<unsigned> nodeGeomList;
+
+	// Parts of the scene frame cache that form the bounds of the object
+	std::vector<BoundsSource> nodeBounds;
+	std::vector<BoundsSource> boneBounds;
+
+	StringTable stringData;
+
+	// Last key of every animation track
+	std::vector<mat4> trackValue;
+	std::vector<unsigned> trackKeyCount;
+
+	std::vector<SpillBlock> blocks;
+
+	// Frames of the current window
+	std::vector<aabb> pendingBounds;
+	std::vector<AnimKeyRecord> pendingKeys;
+};
 
+bool FileSeek(FILE *file, uint64_t pos)
+{
+#if defined(_MSC_VER)
+	return _fseeki64(file, pos, SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(pos), SEEK_SET) == 0;
+#endif
+}
+
+uint64_t FileTell(FILE *file)
+{
+#if defined(_MSC_VER)
+	return _ftelli64(file);
+#else
+	return ftello(file);
+#endif
+}
+
+
+unsigned AppendString(StringTable &stringData, const char *str)
+{
+	auto it = stringData.offsets.insert(std::make_pair(std::string(str), unsigned(stringData.data.size())));
+
+	if(it.second)
+		stringData.data.insert(stringData.data.end(), str, str + strlen(str) + 1);
+
+	return it.first->second;
+}
+
+void BeginNode(NodeExport &target, Context &global, SceneFrameCache &cache)
+{
+	unsigned nodeID = target.nodeID;
+
+	ContextLocal &local = target.local;
+
+	// Redirection tables
+	std::vector<unsigned> &parentRedirection = cache.parentRedirection;
+	std::vector<unsigned> &skeletonRedirection = cache.skeletonRedirection;
+	std::vector<unsigned> &effectRedirection = cache.effectRedirection;
+
+	std::vector<unsigned> usedSkeletons;
+	std::vector<unsigned> usedEffects;
+
+	// Filter nodes and node data of interest
+	// Node is taken if it is the object root, if its parent was taken or if it is a root of a skeleton used by a taken node
+	// Nodes are in document order, so a subtree that is not taken is skipped as a whole
 	std::vector<unsigned> skeletonRoot;
 
-	for(unsigned i = 0; i < global.nodes.size(); i++)
+	for(unsigned i = nodeID == ~0u ? 0 : nodeID; i < global.nodes.size();)
 	{
 		auto&& node = global.nodes[i];
 
-		node.isSkeletonRoot = false;
-
 		bool allowed = i == nodeID;
 
-		for(unsigned k = 0; k < allowedRoots.size(); k++)
-			allowed |= allowedRoots[k] == node.parentNodeID;
-
-		bool isSkeletonRoot = false;
+		if(node.parentNodeID == ~0u)
+			allowed |= nodeID == ~0u;
+		else
+			allowed |= parentRedirection[node.parentNodeID] != ~0u;
 
-		for(unsigned k = 0; k < skeletonRoot.size(); k++)
-			isSkeletonRoot |= skeletonRoot[k] == i;
+		bool isSkeletonRoot = cache.isSkeletonRoot[i];
 
-		if(allowed || isSkeletonRoot)
+		if(!allowed && !isSkeletonRoot)
 		{
-			parentRedirection[i] = local.nodes.size();
-
-			local.nodes.push_back(node);
+			i = node.subtreeEnd;
+			continue;
+		}
 
-			if(isSkeletonRoot)
-				local.nodes.back().isSkeletonRoot = true;
+		parentRedirection[i] = local.nodes.size();
 
-			allowedRoots.push_back(i);
+		local.nodes.push_back(node);
+		target.globalNodes.push_back(i);
 
-			if(node.skeletonID != -1)
-			{
-				LogOptional("Allow nodes from skeleton %d\r\n", node.skeletonID);
+		if(isSkeletonRoot)
+			local.nodes.back().isSkeletonRoot = true;
 
-				unsigned nodeID = global.skeletons[node.skeletonID].nodeIDs[0];
+		if(node.skeletonID != -1 && global.skeletons[node.skeletonID].jointCount != 0)
+		{
+			LogOptional("Allow nodes from skeleton %d\r\n", node.skeletonID);
 
-				for(;;)
-				{
-					if(global.nodes[nodeID].parentNodeID != ~0u)
-						nodeID = global.nodes[nodeID].parentNodeID;
-					else
-						break;
-				}
+			unsigned rootID = cache.rootNode[global.jointNodes[global.skeletons[node.skeletonID].firstJoint]];
 
-				LogOptional("    Skeleton node root is node %d\r\n", nodeID);
+			LogOptional("    Skeleton node root is node %d\r\n", rootID);
 
-				skeletonRoot.push_back(nodeID);
+			// Only roots that follow the node in the document are taken
+			if(rootID > i && !cache.isSkeletonRoot[rootID])
+			{
+				cache.isSkeletonRoot[rootID] = true;
+				skeletonRoot.push_back(rootID);
 			}
 		}
-	}
-
-	LogPrint("Saving node %d (tree size %d out of %d)\r\n", nodeID, local.nodes.size(), global.nodes.size());
-
-	std::vector<char> stringData;
 
-	// Save file header
-	FILE *fOut = fopen(fileNameOut, "wb");
+		i++;
+	}
 
-	LogPrint("Saved file header\r\n");
+	for(unsigned i = 0; i < skeletonRoot.size(); i++)
+		cache.isSkeletonRoot[skeletonRoot[i]] = false;
 
-	unsigned magic = 0x57bedefe;
-	fwrite(&magic, 4, 1, fOut);
+	LogPrint("Saving node %d (tree size %d out of %d)\r\n", nodeID, local.nodes.size(), global.nodes.size());
 
-	unsigned version = 1;
-	fwrite(&version, 4, 1, fOut);
+	StringTable &stringData = target.stringData;
 
-	// Save nodes
-	LogPrint("Saving nodes\r\n");
+	bool nameHashes = global.options.nameHashes;
 
-	unsigned nodeCount = (unsigned)local.nodes.size();
-	fwrite(&nodeCount, 4, 1, fOut);
+	// Collect nodes
+	LogPrint("Collecting nodes\r\n");
 
 	Export::NodeInfo nodeInfo;
 
-	std::vector<Export::NodeInfo> nodeList;
+	std::vector<Export::NodeInfo> &nodeList = target.nodeList;
 	nodeList.resize(local.nodes.size());
 
-	std::vector<unsigned> nodeGeomList;
+	std::vector<unsigned> &nodeGeomList = target.nodeGeomList;
 	nodeGeomList.resize(local.nodes.size());
 
 	for(unsigned i = 0; i < local.nodes.size(); i++)
@@ -137,6 +253,7 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 
 		LogOptional(" Node %d ", i);
 		nodeInfo.nameOffset = AppendString(stringData, node.name);
+		nodeInfo.nameHash = nameHashes ? Export::NameHash(node.name) : 0;
 
 		unsigned geomID = -1;
 
@@ -147,6 +264,7 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 			LogOptional("references animated geometry %d through controller %d\r\n", geomID, node.controllerID);
 
 			nodeInfo.geometryNameOffset = AppendString(stringData, global.geometryIDs[geomID]);
+			nodeInfo.geometryNameHash = nameHashes ? Export::NameHash(global.geometryIDs[geomID]) : 0;
 		}
 		else if(node.geometryID != -1)
 		{
@@ -155,6 +273,7 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 			LogOptional("references static geometry %d\r\n", geomID);
 
 			nodeInfo.geometryNameOffset = AppendString(stringData, global.geometryIDs[geomID]);
+			nodeInfo.geometryNameHash = nameHashes ? Export::NameHash(global.geometryIDs[geomID]) : 0;
 		}
 		else
 		{
@@ -170,16 +289,24 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 			{
 				skeletonRedirection[node.skeletonID] = local.skeletons.size();
 				local.skeletons.push_back(global.skeletons[node.skeletonID]);
+				usedSkeletons.push_back(node.skeletonID);
 
 				LogOptional("    Redirected to skeleton %d\r\n", skeletonRedirection[node.skeletonID]);
 
 				auto &skeleton = local.skeletons.back();
 
+				unsigned firstJoint = skeleton.firstJoint;
+
+				skeleton.firstJoint = unsigned(local.jointNodes.size());
+
 				for(unsigned k = 0; k < skeleton.jointCount; k++)
 				{
-					LogOptional("        Redirected skeleton joint %d to %d\r\n", skeleton.nodeIDs[k], parentRedirection[skeleton.nodeIDs[k]]);
+					unsigned jointNode = global.jointNodes[firstJoint + k];
+
+					LogOptional("        Redirected skeleton joint %d to %d\r\n", jointNode, parentRedirection[jointNode]);
 
-					skeleton.nodeIDs[k] = parentRedirection[skeleton.nodeIDs[k]];
+					local.jointNodes.push_back(parentRedirection[jointNode]);
+					local.jointBindMat.push_back(global.jointBindMat[firstJoint + k]);
 				}
 			}
 		}
@@ -199,6 +326,7 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 			{
 				effectRedirection[node.effectID] = local.effects.size();
 				local.effects.push_back(global.effects[node.effectID]);
+				usedEffects.push_back(node.effectID);
 				LogOptional("    Redirected to effect %d\r\n", effectRedirection[node.effectID]);
 			}
 		}
@@ -210,7 +338,7 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 		nodeInfo.effectID = node.effectID == -1 ? -1 : effectRedirection[node.effectID];
 		nodeInfo.flags = 0;
 
-		LogOptional("  geomID: %d, parentID: %d, skeletonId: %d, geometry: %s\r\n", geomID, nodeInfo.parentID, nodeInfo.controllerID, stringData.data() + nodeInfo.geometryNameOffset);
+		LogOptional("  geomID: %d, parentID: %d, skeletonId: %d, geometry: %s\r\n", geomID, nodeInfo.parentID, nodeInfo.controllerID, stringData.data.data() + nodeInfo.geometryNameOffset);
 
 		if((nodeID != -1 && parentRedirection[nodeID] == i))
 		{
@@ -229,51 +357,17 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 			nodeInfo.model = nodeInfo.modelOriginal;
 		}
 
-		fwrite(&nodeInfo, sizeof(nodeInfo), 1, fOut);
-
 		nodeList[i] = nodeInfo;
 	}
 
-	// Save skeletons
-	LogPrint("Saving controllers\r\n");
-	unsigned controllerCount= (unsigned)local.skeletons.size();
-	fwrite(&controllerCount, 4, 1, fOut);
-
-	for(unsigned i = 0; i < local.skeletons.size(); i++)
-	{
-		auto&& skeleton = local.skeletons[i];
-
-		LogOptional(" Skeleton %d has %d bones\r\n", i, skeleton.jointCount);
-
-		Export::ControllerInfo sk;
-
-		sk.boneCount = skeleton.jointCount;
-		sk.bindPose = skeleton.bindShapeMat;
-
-		fwrite(&sk, sizeof(sk), 1, fOut);
-
-		// Save node IDs
-		fwrite(&skeleton.nodeIDs[0], 4, skeleton.jointCount, fOut);
-
-		// Save bind matrices
-		fwrite(&skeleton.bindMat[0], 64, skeleton.jointCount, fOut);
-
-		// Save bone geometry bounds
-		fwrite(global.contrls[skeleton.controllerID]->bounds, sizeof(aabb), skeleton.jointCount, fOut);
-	}
-
 	// Find which nodes are animated in the local node tree
-	std::vector<unsigned> animNodeRedirection;
+	std::vector<unsigned> &animNodeRedirection = target.animNodeRedirection;
 
 	for(unsigned i = 0; i < global.animatedNodes.size(); i++)
 	{
 		unsigned id = global.animatedNodes[i];
-		bool allowed = id == nodeID;
 
-		for(unsigned k = 0; k < allowedRoots.size(); k++)
-			allowed |= allowedRoots[k] == id;
-
-		if(allowed)
+		if(parentRedirection[id] != ~0u)
 		{
 			animNodeRedirection.push_back(i);
 			local.animatedNodes.push_back(parentRedirection[id]);
@@ -284,147 +378,1076 @@ void SaveNode(char* fileNameOut, unsigned nodeID, Context &global)
 
 	LogPrint("Out of %d animated nodes this tree contains %d\r\n", global.animatedNodes.size(), local.animatedNodes.size());
 
+	// Release shared redirection tables for the next object
+	for(unsigned i = 0; i < target.globalNodes.size(); i++)
+		parentRedirection[target.globalNodes[i]] = ~0u;
+
+	for(unsigned i = 0; i < usedSkeletons.size(); i++)
+		skeletonRedirection[usedSkeletons[i]] = ~0u;
+
+	for(unsigned i = 0; i < usedEffects.size(); i++)
+		effectRedirection[usedEffects[i]] = ~0u;
+
 	local.animSampleCount = global.animSampleCount;
 
 	if(local.animSampleCount == -1)
 		local.animSampleCount = 0;
 
-	// Find out animation matrices
-	local.matrixAnimation = new mat4[local.animSampleCount * local.animatedNodes.size()];
+	// Find how the top-level nodes of the tree are moved relative to the scene
+	std::unordered_map<unsigned, vec3> rootOffset;
 
-	for(unsigned n = 0; n < local.animSampleCount; n++)
+	for(unsigned i = 0; i < local.nodes.size(); i++)
 	{
-		for(unsigned i = 0; i < local.animatedNodes.size(); i++)
+		auto &node = local.nodes[i];
+
+		if(node.parentNodeID != -1)
+			continue;
+
+		vec3 offset(0, 0, 0);
+
+		if(cache.animRedirection[target.globalNodes[i]] != ~0u)
+		{
+			if(node.isSkeletonRoot)
+				offset = vec3(-node.model.mat[12], -node.model.mat[13], 0);
+		}
+		else if(target.globalNodes[i] == nodeID)
 		{
-			auto &source = global.matrixAnimation[n * global.animatedNodes.size() + animNodeRedirection[i]];
+			offset = vec3(-node.model.mat[12], -node.model.mat[13], -node.model.mat[14]);
+		}
+
+		rootOffset[target.globalNodes[i]] = offset;
+	}
 
-			auto &target = local.matrixAnimation[n * local.animatedNodes.size() + i];
+	for(unsigned i = 0; i < local.nodes.size(); i++)
+	{
+		auto &node = local.nodes[i];
 
-			target = source;
+		if(nodeList[i].geometryNameOffset == 0) // Skip empty nodes
+			continue;
 
-			auto &node = local.nodes[local.animatedNodes[i]];
+		BoundsSource source;
 
-			if(node.isSkeletonRoot)
+		if(node.skeletonID != -1)
+		{
+			auto &skeleton = global.skeletons[node.skeletonID];
+
+			for(unsigned k = 0; k < skeleton.jointCount; k++)
 			{
-				target.mat[12] -= node.model.mat[12];
-				target.mat[13] -= node.model.mat[13];
+				auto it = rootOffset.find(cache.rootNode[global.jointNodes[skeleton.firstJoint + k]]);
+
+				source.index = cache.skeletonBoneOffset[node.skeletonID] + k;
+				source.offset = it != rootOffset.end() ? it->second : vec3(0, 0, 0);
+
+				target.boneBounds.push_back(source);
 			}
 		}
+		else
+		{
+			auto it = rootOffset.find(cache.rootNode[target.globalNodes[i]]);
+
+			source.index = cache.geometryIndex[target.globalNodes[i]];
+			source.offset = it != rootOffset.end() ? it->second : vec3(0, 0, 0);
+
+			target.nodeBounds.push_back(source);
+		}
 	}
 
-	unsigned animNodeCount = local.animatedNodes.size();
-	fwrite(&animNodeCount, 4, 1, fOut);
+	target.trackValue.resize(local.animatedNodes.size());
+	target.trackKeyCount.resize(local.animatedNodes.size(), 0);
+}
 
-	if(local.animatedNodes.size())
-		fwrite(&local.animatedNodes[0], 4, local.animatedNodes.size(), fOut);
+void PrepareFrameCache(SceneFrameCache &cache, Context &global)
+{
+	cache.animRedirection.resize(global.nodes.size(), ~0u);
 
-	fwrite(&local.animSampleCount, 4, 1, fOut);
+	for(unsigned i = 0; i < global.animatedNodes.size(); i++)
+		cache.animRedirection[global.animatedNodes[i]] = i;
+
+	cache.rootNode.resize(global.nodes.size());
 
-	if(local.animatedNodes.size() && local.animSampleCount)
-		fwrite(local.matrixAnimation, sizeof(mat4), local.animSampleCount * local.animatedNodes.size(), fOut);
+	cache.parentRedirection.resize(global.nodes.size(), ~0u);
+	cache.skeletonRedirection.resize(global.skeletons.size(), ~0u);
+	cache.effectRedirection.resize(global.effects.size(), ~0u);
+	cache.isSkeletonRoot.resize(global.nodes.size(), false);
 
-	unsigned frameCount = local.animSampleCount ? local.animSampleCount : 1;
+	for(unsigned i = 0; i < global.nodes.size(); i++)
+	{
+		unsigned parent = global.nodes[i].parentNodeID;
 
-	std::array<mat4, 256> bones;
+		cache.rootNode[i] = parent == -1 ? i : cache.rootNode[parent];
+	}
 
-	aabb *aabbState = new aabb[frameCount];
+	cache.geometryIndex.resize(global.nodes.size(), ~0u);
 
-	for(unsigned n = 0; n < frameCount; n++)
+	for(unsigned i = 0; i < global.nodes.size(); i++)
 	{
-		// Prepare animation
-		for(uint32_t i = 0; i < local.animatedNodes.size(); i++)
-			nodeList[local.animatedNodes[i]].modelOriginal = local.matrixAnimation[local.animatedNodes.size() * n + i];
+		auto &node = global.nodes[i];
 
-		// Prepare transformations
-		for(unsigned i = 0; i < local.nodes.size(); i++)
+		if(node.skeletonID == -1 && node.geometryID != -1)
 		{
-			Export::NodeInfo& node = nodeList[i];
-
-			// Transform node by parent matrix
-			if(node.parentID != -1)
-				mul(node.model, nodeList[node.parentID].model, node.modelOriginal);
-			else
-				nodeList[i].model = node.modelOriginal;
+			cache.geometryIndex[i] = unsigned(cache.geometryNodes.size());
+			cache.geometryNodes.push_back(i);
 		}
+	}
 
-		bool aabbSet = false;
-		for(unsigned i = 0; i < local.nodes.size(); i++)
-		{
-			Export::NodeInfo& node = nodeList[i];
+	cache.geometryWorld.resize(unsigned(cache.geometryNodes.size()));
+	cache.geometryLocal.resize(unsigned(cache.geometryNodes.size()));
 
-			if(node.geometryNameOffset != 0) // Skip empty nodes
-			{
-				if(node.controllerID != -1)
-				{
-					DAESkeleton &skeleton = local.skeletons[node.controllerID];
-
-					for(uint32_t i = 0; i < skeleton.jointCount; i++)
-					{
-						mul(bones[i], nodeList[skeleton.nodeIDs[i]].model, skeleton.bindMat[i]);
-
-						aabb bounds = global.contrls[skeleton.controllerID]->bounds[i];
-						bounds.mul(bones[i]);
-						if(!aabbSet)
-						{
-							aabbState[n] = bounds;
-							aabbSet = true;
-						}
-						else
-						{
-							aabbState[n].merge(bounds);
-						}
-					}
-				}
-				else
-				{
-					aabb bounds = global.geoms[nodeGeomList[i]]->bounds;
-					bounds.mul(node.model);
-					if(!aabbSet)
-					{
-						aabbState[n] = bounds;
-						aabbSet = true;
-					}
-					else
-					{
-						aabbState[n].merge(bounds);
-					}
-				}
-			}
+	for(unsigned i = 0; i < cache.geometryNodes.size(); i++)
+		cache.geometryLocal.set(i, global.geoms[global.nodes[cache.geometryNodes[i]].geometryID]->bounds);
+
+	for(unsigned i = 0; i < global.skeletons.size(); i++)
+	{
+		DAESkeleton &skeleton = global.skeletons[i];
+
+		cache.skeletonBoneOffset.push_back(unsigned(cache.boneNodes.size()));
+
+		for(uint32_t k = 0; k < skeleton.jointCount; k++)
+			cache.boneNodes.push_back(global.jointNodes[skeleton.firstJoint + k]);
+	}
+
+	unsigned boneCount = unsigned(cache.boneNodes.size());
+
+	cache.boneWorld.resize(boneCount);
+	cache.boneBind.resize(boneCount);
+	cache.boneMatrices.resize(boneCount);
+	cache.boneLocal.resize(boneCount);
+
+	for(unsigned i = 0; i < global.skeletons.size(); i++)
+	{
+		DAESkeleton &skeleton = global.skeletons[i];
+
+		for(uint32_t k = 0; k < skeleton.jointCount; k++)
+		{
+			cache.boneBind.set(cache.skeletonBoneOffset[i] + k, global.jointBindMat[skeleton.firstJoint + k]);
+			cache.boneLocal.set(cache.skeletonBoneOffset[i] + k, global.contrls[skeleton.controllerID]->bounds[k]);
 		}
 	}
 
-	fwrite(aabbState, sizeof(aabb), frameCount, fOut);
+	cache.world.resize(global.nodes.size());
+	cache.nodeBounds.resize(cache.geometryNodes.size());
+	cache.boneBounds.resize(boneCount);
+}
+
+// Samples of the animated nodes at the frame, or NULL for the idle state
+void UpdateFrameCache(SceneFrameCache &cache, Context &global, const mat4 *samples)
+{
+	for(unsigned i = 0; i < global.nodes.size(); i++)
+	{
+		auto &node = global.nodes[i];
 
-	delete[] aabbState;
+		unsigned animID = cache.animRedirection[i];
 
-	unsigned materialCount = local.effects.size();
-	fwrite(&materialCount, 4, 1, fOut);
+		const mat4 &modelOriginal = samples && animID != ~0u ? samples[animID] : node.model;
 
-	for(unsigned i = 0; i < local.effects.size(); i++)
+		// Transform node by parent matrix
+		if(node.parentNodeID != -1)
+			mul(cache.world[i], cache.world[node.parentNodeID], modelOriginal);
+		else
+			cache.world[i] = modelOriginal;
+	}
+
+	// Geometry and bones of all objects are transformed in batches
+	for(unsigned i = 0; i < cache.geometryNodes.size(); i++)
+		cache.geometryWorld.set(i, cache.world[cache.geometryNodes[i]]);
+
+	if(!cache.nodeBounds.empty())
+		BatchTransformBounds(cache.nodeBounds.data(), cache.geometryLocal, cache.geometryWorld);
+
+	for(unsigned i = 0; i < cache.boneNodes.size(); i++)
+		cache.boneWorld.set(i, cache.world[cache.boneNodes[i]]);
+
+	if(!cache.boneBounds.empty())
 	{
-		auto&& effect = local.effects[i];
+		BatchMul(cache.boneMatrices, cache.boneWorld, cache.boneBind);
+		BatchTransformBounds(cache.boneBounds.data(), cache.boneLocal, cache.boneMatrices);
+	}
+}
 
-		Export::MaterialInfo info;
+aabb CalculateBounds(NodeExport &target, SceneFrameCache &cache)
+{
+	aabb result;
+	memset(&result, 0, sizeof(aabb));
 
-		if(effect.diffuseColor != ~0u)
-			info.colorStringOffset = AppendString(stringData, global.images[effect.diffuseColor].path);
+	bool aabbSet = false;
+
+	for(unsigned i = 0; i < target.nodeBounds.size(); i++)
+	{
+		aabb bounds = cache.nodeBounds[target.nodeBounds[i].index];
+		bounds.center = bounds.center + target.nodeBounds[i].offset;
+
+		if(!aabbSet)
+		{
+			result = bounds;
+			aabbSet = true;
+		}
 		else
-			info.colorStringOffset = 0;
+		{
+			result.merge(bounds);
+		}
+	}
 
-		if(effect.diffuseAlpha != ~0u)
-			info.alphaStringOffset = AppendString(stringData, global.images[effect.diffuseAlpha].path);
+	for(unsigned i = 0; i < target.boneBounds.size(); i++)
+	{
+		aabb bounds = cache.boneBounds[target.boneBounds[i].index];
+		bounds.center = bounds.center + target.boneBounds[i].offset;
+
+		if(!aabbSet)
+		{
+			result = bounds;
+			aabbSet = true;
+		}
 		else
-			info.alphaStringOffset = 0;
+		{
+			result.merge(bounds);
+		}
+	}
+
+	return result;
+}
+
+void SaveNodeFrame(NodeExport &target, Context &global, SceneFrameCache &cache, unsigned frame, const mat4 *samples)
+{
+	ContextLocal &local = target.local;
+
+	if(frame >= local.animSampleCount)
+		return;
+
+	for(unsigned i = 0; i < local.animatedNodes.size(); i++)
+	{
+		mat4 value = samples[target.animNodeRedirection[i]];
+
+		auto &node = local.nodes[local.animatedNodes[i]];
+
+		if(node.isSkeletonRoot)
+		{
+			value.mat[12] -= node.model.mat[12];
+			value.mat[13] -= node.model.mat[13];
+		}
 
-		fwrite(&info, sizeof(info), 1, fOut);
+		// Frames that repeat the last key of the track are held by that key
+		if(target.trackKeyCount[i] == 0 || memcmp(&value, &target.trackValue[i], sizeof(mat4)) != 0)
+		{
+			AnimKeyRecord key;
+
+			key.track = i;
+			key.frame = frame;
+			key.value = value;
+
+			target.pendingKeys.push_back(key);
+
+			target.trackValue[i] = value;
+			target.trackKeyCount[i]++;
+		}
 	}
 
-	unsigned stringSize = stringData.size();
+	target.pendingBounds.push_back(CalculateBounds(target, cache));
+}
 
-	fwrite(&stringSize, 4, 1, fOut);
-	fwrite(stringData.data(), 1, stringData.size(), fOut);
+void FlushNodeFrames(NodeExport &target, FILE *spill)
+{
+	if(target.pendingBounds.empty())
+		return;
 
-	fclose(fOut);
+	SpillBlock block;
 
-	LogPrint("-------------------------------\r\n");
+	fseek(spill, 0, SEEK_END);
+
+	block.offset = FileTell(spill);
+	block.frameCount = target.pendingBounds.size();
+	block.keyCount = target.pendingKeys.size();
+
+	fwrite(target.pendingBounds.data(), sizeof(aabb), target.pendingBounds.size(), spill);
+
+	if(!target.pendingKeys.empty())
+		fwrite(target.pendingKeys.data(), sizeof(AnimKeyRecord), target.pendingKeys.size(), spill);
+
+	target.blocks.push_back(block);
+
+	target.pendingBounds.clear();
+	target.pendingKeys.clear();
+}
+
+// Keys are spilled in frame order, one block at a time they are moved to their place in the track order
+// Returns bounds of all frames
+aabb SaveAnimationKeys(NodeExport &target, SceneFrameCache &cache, FILE *fOut, FILE *spill, const std::vector<unsigned> &trackRedirection, const std::vector<Export::AnimTrackInfo> &animTracks, uint64_t keyFramesPos, uint64_t keysPos, uint64_t boundsPos)
+{
+	std::vector<unsigned> trackWritten(animTracks.size(), 0);
+
+	std::vector<AnimKeyRecord> keys;
+	std::vector<std::pair<unsigned, unsigned>> order;
+
+	std::vector<unsigned> keyFrames;
+	std::vector<mat4> keyValues;
+
+	for(unsigned i = 0; i < target.blocks.size(); i++)
+	{
+		auto &block = target.blocks[i];
+
+		if(!block.keyCount)
+			continue;
+
+		keys.resize(block.keyCount);
+
+		FileSeek(spill, block.offset + sizeof(aabb) * block.frameCount);
+		fread(keys.data(), sizeof(AnimKeyRecord), keys.size(), spill);
+
+		order.clear();
+
+		for(unsigned k = 0; k < keys.size(); k++)
+		{
+			unsigned track = trackRedirection[keys[k].track];
+
+			if(track == ~0u)
+				continue;
+
+			order.push_back(std::make_pair(animTracks[track].firstKey + trackWritten[track]++, k));
+		}
+
+		std::sort(order.begin(), order.end());
+
+		// Write runs of consecutive keys
+		for(unsigned start = 0, end = 0; start < order.size(); start = end)
+		{
+			keyFrames.clear();
+			keyValues.clear();
+
+			for(end = start; end < order.size() && order[end].first == order[start].first + (end - start); end++)
+			{
+				keyFrames.push_back(keys[order[end].second].frame);
+				keyValues.push_back(keys[order[end].second].value);
+			}
+
+			FileSeek(fOut, keyFramesPos + 4ull * order[start].first);
+			fwrite(keyFrames.data(), 4, keyFrames.size(), fOut);
+
+			FileSeek(fOut, keysPos + sizeof(mat4) * uint64_t(order[start].first));
+			fwrite(keyValues.data(), sizeof(mat4), keyValues.size(), fOut);
+		}
+	}
+
+	FileSeek(fOut, boundsPos);
+
+	aabb totalBounds;
+
+	if(target.blocks.empty())
+	{
+		totalBounds = CalculateBounds(target, cache);
+
+		fwrite(&totalBounds, sizeof(aabb), 1, fOut);
+	}
+	else
+	{
+		std::vector<aabb> bounds;
+
+		for(unsigned i = 0; i < target.blocks.size(); i++)
+		{
+			auto &block = target.blocks[i];
+
+			bounds.resize(block.frameCount);
+
+			FileSeek(spill, block.offset);
+			fread(bounds.data(), sizeof(aabb), bounds.size(), spill);
+
+			fwrite(bounds.data(), sizeof(aabb), bounds.size(), fOut);
+
+			for(unsigned k = 0; k < bounds.size(); k++)
+			{
+				if(i == 0 && k == 0)
+					totalBounds = bounds[k];
+				else
+					totalBounds.merge(bounds[k]);
+			}
+		}
+	}
+
+	return totalBounds;
+}
+
+void SaveAnimationTracks(NodeExport &target, SceneFrameCache &cache, FILE *fOut, FILE *spill, const std::vector<unsigned> &trackRedirection, const std::vector<Export::AnimTrackInfo> &animTracks, unsigned animKeyCount)
+{
+	if(!animTracks.empty())
+		fwrite(&animTracks[0], sizeof(Export::AnimTrackInfo), animTracks.size(), fOut);
+
+	fwrite(&animKeyCount, 4, 1, fOut);
+
+	uint64_t keyFramesPos = FileTell(fOut);
+	uint64_t keysPos = keyFramesPos + 4ull * animKeyCount;
+	uint64_t boundsPos = keysPos + sizeof(mat4) * uint64_t(animKeyCount);
+
+	SaveAnimationKeys(target, cache, fOut, spill, trackRedirection, animTracks, keyFramesPos, keysPos, boundsPos);
+}
+
+// Every chunk restates the value of every track at its first frame, so that it can be played without the chunks before it
+aabb SaveAnimationChunks(NodeExport &target, FILE *fOut, FILE *spill, const std::vector<unsigned> &trackRedirection, unsigned trackCount, std::vector<Export::AnimChunkInfo> &animChunks)
+{
+	std::vector<mat4> trackValue(trackCount);
+	std::vector<unsigned> trackCursor(trackCount);
+
+	std::vector<Export::AnimTrackInfo> chunkTracks(trackCount);
+
+	std::vector<unsigned> keyFrames;
+	std::vector<mat4> keyValues;
+
+	// Frames and keys that were read from the spill file, but weren't saved yet
+	std::vector<aabb> pendingBounds;
+	std::vector<AnimKeyRecord> pendingKeys;
+
+	std::vector<aabb> blockBounds;
+	std::vector<AnimKeyRecord> blockKeys;
+
+	unsigned nextBlock = 0;
+
+	aabb totalBounds;
+
+	for(unsigned i = 0; i < animChunks.size(); i++)
+	{
+		auto &chunk = animChunks[i];
+
+		while(pendingBounds.size() < chunk.frameCount && nextBlock < target.blocks.size())
+		{
+			auto &block = target.blocks[nextBlock++];
+
+			blockBounds.resize(block.frameCount);
+			blockKeys.resize(block.keyCount);
+
+			FileSeek(spill, block.offset);
+			fread(blockBounds.data(), sizeof(aabb), blockBounds.size(), spill);
+
+			if(!blockKeys.empty())
+				fread(blockKeys.data(), sizeof(AnimKeyRecord), blockKeys.size(), spill);
+
+			pendingBounds.insert(pendingBounds.end(), blockBounds.begin(), blockBounds.end());
+
+			for(unsigned k = 0; k < blockKeys.size(); k++)
+			{
+				if(trackRedirection[blockKeys[k].track] == ~0u)
+					continue;
+
+				blockKeys[k].track = trackRedirection[blockKeys[k].track];
+
+				pendingKeys.push_back(blockKeys[k]);
+			}
+		}
+
+		assert(pendingBounds.size() >= chunk.frameCount);
+
+		// Keys are sorted by frame, so the keys of the chunk are at the start
+		unsigned chunkKeyCount = 0;
+
+		while(chunkKeyCount < pendingKeys.size() && pendingKeys[chunkKeyCount].frame < chunk.firstFrame + chunk.frameCount)
+			chunkKeyCount++;
+
+		for(unsigned k = 0; k < trackCount; k++)
+			chunkTracks[k].keyCount = 1;
+
+		for(unsigned k = 0; k < chunkKeyCount; k++)
+		{
+			if(pendingKeys[k].frame != chunk.firstFrame)
+				chunkTracks[pendingKeys[k].track].keyCount++;
+		}
+
+		unsigned keyCount = 0;
+
+		for(unsigned k = 0; k < trackCount; k++)
+		{
+			chunkTracks[k].firstKey = keyCount;
+			keyCount += chunkTracks[k].keyCount;
+
+			trackCursor[k] = chunkTracks[k].firstKey + 1;
+		}
+
+		keyFrames.resize(keyCount);
+		keyValues.resize(keyCount);
+
+		for(unsigned k = 0; k < trackCount; k++)
+		{
+			keyFrames[chunkTracks[k].firstKey] = chunk.firstFrame;
+			keyValues[chunkTracks[k].firstKey] = trackValue[k];
+		}
+
+		for(unsigned k = 0; k < chunkKeyCount; k++)
+		{
+			auto &key = pendingKeys[k];
+
+			if(key.frame == chunk.firstFrame)
+			{
+				keyValues[chunkTracks[key.track].firstKey] = key.value;
+			}
+			else
+			{
+				keyFrames[trackCursor[key.track]] = key.frame;
+				keyValues[trackCursor[key.track]] = key.value;
+
+				trackCursor[key.track]++;
+			}
+
+			trackValue[key.track] = key.value;
+		}
+
+		chunk.offset = FileTell(fOut);
+
+		if(trackCount)
+			fwrite(&chunkTracks[0], sizeof(Export::AnimTrackInfo), trackCount, fOut);
+
+		fwrite(&keyCount, 4, 1, fOut);
+
+		if(keyCount)
+		{
+			fwrite(keyFrames.data(), 4, keyCount, fOut);
+			fwrite(keyValues.data(), sizeof(mat4), keyCount, fOut);
+		}
+
+		fwrite(pendingBounds.data(), sizeof(aabb), chunk.frameCount, fOut);
+
+		chunk.size = FileTell(fOut) - chunk.offset;
+
+		chunk.bounds = pendingBounds[0];
+
+		for(unsigned k = 1; k < chunk.frameCount; k++)
+			chunk.bounds.merge(pendingBounds[k]);
+
+		if(i == 0)
+			totalBounds = chunk.bounds;
+		else
+			totalBounds.merge(chunk.bounds);
+
+		LogOptional("  Chunk %d at frame %d has %d keys (%d bytes)\r\n", i, chunk.firstFrame, keyCount, unsigned(chunk.size));
+
+		pendingKeys.erase(pendingKeys.begin(), pendingKeys.begin() + chunkKeyCount);
+		pendingBounds.erase(pendingBounds.begin(), pendingBounds.begin() + chunk.frameCount);
+	}
+
+	return totalBounds;
+}
+
+uint64_t AlignSection(uint64_t offset)
+{
+	return (offset + Export::MeshSectionAlignment - 1) & ~uint64_t(Export::MeshSectionAlignment - 1);
+}
+
+// Writes zeros from the current position of the file up to the offset
+void WritePadding(FILE *fOut, uint64_t offset)
+{
+	static const char zeros[Export::MeshSectionAlignment] = {};
+
+	uint64_t pos = FileTell(fOut);
+
+	assert(offset >= pos && offset - pos <= sizeof(zeros));
+
+	fwrite(zeros, 1, size_t(offset - pos), fOut);
+}
+
+void WriteSection(FILE *fOut, const Export::MeshSection &section, const void *data)
+{
+	WritePadding(fOut, section.offset);
+
+	if(section.count)
+		fwrite(data, section.stride, section.count, fOut);
+}
+
+// Version 5 object file, every section size is known up front, so the layout is placed before the data
+void SaveMappedSections(NodeExport &target, Context &global, SceneFrameCache &cache, FILE *fOut, FILE *spill, const std::vector<unsigned> &animTrackNodes, const std::vector<unsigned> &trackRedirection, const std::vector<Export::AnimTrackInfo> &animTracks, unsigned animKeyCount, std::vector<Export::AnimChunkInfo> &animChunks, const std::vector<Export::MaterialInfo> &materials)
+{
+	ContextLocal &local = target.local;
+	StringTable &stringData = target.stringData;
+
+	bool chunked = !animChunks.empty();
+
+	// Bones of the local skeletons are already stored one skeleton after another
+	std::vector<Export::ControllerLayout> controllers(local.skeletons.size());
+	std::vector<aabb> boneBounds;
+
+	for(unsigned i = 0; i < local.skeletons.size(); i++)
+	{
+		auto&& skeleton = local.skeletons[i];
+
+		controllers[i].boneCount = skeleton.jointCount;
+		controllers[i].firstBone = skeleton.firstJoint;
+		controllers[i].bindPose = skeleton.bindShapeMat;
+
+		auto &bounds = global.contrls[skeleton.controllerID]->bounds;
+
+		boneBounds.insert(boneBounds.end(), bounds, bounds + skeleton.jointCount);
+	}
+
+	Export::MeshLayout layout;
+	memset(&layout, 0, sizeof(layout));
+
+	layout.sectionCount = Export::MS_COUNT;
+	layout.animSampleCount = local.animSampleCount;
+
+	unsigned counts[Export::MS_COUNT] = {};
+	unsigned strides[Export::MS_COUNT] = {};
+
+	counts[Export::MS_NODES] = target.nodeList.size();
+	strides[Export::MS_NODES] = sizeof(Export::NodeInfo);
+
+	counts[Export::MS_CONTROLLERS] = controllers.size();
+	strides[Export::MS_CONTROLLERS] = sizeof(Export::ControllerLayout);
+
+	counts[Export::MS_BONE_NODES] = local.jointNodes.size();
+	strides[Export::MS_BONE_NODES] = 4;
+
+	counts[Export::MS_BONE_BIND_MATS] = local.jointBindMat.size();
+	strides[Export::MS_BONE_BIND_MATS] = sizeof(mat4);
+
+	counts[Export::MS_BONE_BOUNDS] = boneBounds.size();
+	strides[Export::MS_BONE_BOUNDS] = sizeof(aabb);
+
+	counts[Export::MS_ANIM_NODES] = animTrackNodes.size();
+	strides[Export::MS_ANIM_NODES] = 4;
+
+	counts[Export::MS_ANIM_TRACKS] = chunked ? 0 : animTracks.size();
+	strides[Export::MS_ANIM_TRACKS] = sizeof(Export::AnimTrackInfo);
+
+	counts[Export::MS_ANIM_KEY_FRAMES] = chunked ? 0 : animKeyCount;
+	strides[Export::MS_ANIM_KEY_FRAMES] = 4;
+
+	counts[Export::MS_ANIM_KEYS] = chunked ? 0 : animKeyCount;
+	strides[Export::MS_ANIM_KEYS] = sizeof(mat4);
+
+	counts[Export::MS_AABB_STATE] = chunked ? 0 : (local.animSampleCount ? local.animSampleCount : 1);
+	strides[Export::MS_AABB_STATE] = sizeof(aabb);
+
+	counts[Export::MS_ANIM_CHUNKS] = animChunks.size();
+	strides[Export::MS_ANIM_CHUNKS] = sizeof(Export::AnimChunkInfo);
+
+	counts[Export::MS_MATERIALS] = materials.size();
+	strides[Export::MS_MATERIALS] = sizeof(Export::MaterialInfo);
+
+	counts[Export::MS_STRINGS] = stringData.data.size();
+	strides[Export::MS_STRINGS] = 1;
+
+	uint64_t layoutPos = AlignSection(sizeof(Export::MeshInfo));
+	uint64_t offset = layoutPos + sizeof(Export::MeshLayout);
+
+	for(unsigned i = 0; i < Export::MS_COUNT; i++)
+	{
+		offset = AlignSection(offset);
+
+		layout.sections[i].offset = offset;
+		layout.sections[i].count = counts[i];
+		layout.sections[i].stride = strides[i];
+
+		offset += uint64_t(counts[i]) * strides[i];
+	}
+
+	// Layout is saved again once the bounds and the file size are known
+	WritePadding(fOut, layoutPos);
+	fwrite(&layout, sizeof(layout), 1, fOut);
+
+	LogPrint("Saving nodes and controllers\r\n");
+
+	WriteSection(fOut, layout.sections[Export::MS_NODES], target.nodeList.data());
+	WriteSection(fOut, layout.sections[Export::MS_CONTROLLERS], controllers.data());
+	WriteSection(fOut, layout.sections[Export::MS_BONE_NODES], local.jointNodes.data());
+	WriteSection(fOut, layout.sections[Export::MS_BONE_BIND_MATS], local.jointBindMat.data());
+	WriteSection(fOut, layout.sections[Export::MS_BONE_BOUNDS], boneBounds.data());
+	WriteSection(fOut, layout.sections[Export::MS_ANIM_NODES], animTrackNodes.data());
+
+	if(!chunked)
+	{
+		auto &keyFrames = layout.sections[Export::MS_ANIM_KEY_FRAMES];
+		auto &keys = layout.sections[Export::MS_ANIM_KEYS];
+		auto &aabbState = layout.sections[Export::MS_AABB_STATE];
+
+		WriteSection(fOut, layout.sections[Export::MS_ANIM_TRACKS], animTracks.data());
+		WritePadding(fOut, keyFrames.offset);
+
+		layout.bounds = SaveAnimationKeys(target, cache, fOut, spill, trackRedirection, animTracks, keyFrames.offset, keys.offset, aabbState.offset);
+
+		uint64_t endPos = FileTell(fOut);
+
+		// Keys are written out of order, padding between their sections is filled in separately
+		FileSeek(fOut, keyFrames.offset + 4ull * keyFrames.count);
+		WritePadding(fOut, keys.offset);
+
+		FileSeek(fOut, endPos);
+	}
+
+	WriteSection(fOut, layout.sections[Export::MS_ANIM_CHUNKS], animChunks.data());
+	WriteSection(fOut, layout.sections[Export::MS_MATERIALS], materials.data());
+	WriteSection(fOut, layout.sections[Export::MS_STRINGS], stringData.data.data());
+
+	LogPrint("Saved %d unique strings (%d bytes)\r\n", stringData.offsets.size(), stringData.data.size());
+
+	if(chunked)
+	{
+		WritePadding(fOut, AlignSection(FileTell(fOut)));
+
+		layout.bounds = SaveAnimationChunks(target, fOut, spill, trackRedirection, animTracks.size(), animChunks);
+
+		FileSeek(fOut, layout.sections[Export::MS_ANIM_CHUNKS].offset);
+		fwrite(&animChunks[0], sizeof(Export::AnimChunkInfo), animChunks.size(), fOut);
+
+		fseek(fOut, 0, SEEK_END);
+	}
+
+	layout.fileSize = FileTell(fOut);
+
+	FileSeek(fOut, layoutPos);
+	fwrite(&layout, sizeof(layout), 1, fOut);
+
+	LogPrint("Saved %d sections (%d bytes)\r\n", Export::MS_COUNT, unsigned(layout.fileSize));
+}
+
+// Complete object is moved into the archive or over the output file
+void CloseNodeFile(NodeExport &target, Context &global, FILE *fOut, ArchiveWriter *archive, const char *tempName)
+{
+	// Short write leaves a truncated object, it must not replace the output
+	bool written = ferror(fOut) == 0 && fflush(fOut) == 0;
+
+	if(!written)
+	{
+		LogPrint("Failed to write '%s'\r\n", tempName);
+
+		fclose(fOut);
+		remove(tempName);
+
+		outputStats.failed++;
+		global.outputFailed = true;
+	}
+	else if(archive)
+	{
+		const char *name = strrchr(target.fileName, '/');
+
+		if(!AddArchiveFile(*archive, name ? name + 1 : target.fileName, fOut, Export::MeshSectionAlignment))
+		{
+			LogPrint("Failed to add '%s' to the archive\r\n", target.fileName);
+			global.outputFailed = true;
+		}
+
+		fclose(fOut);
+		remove(tempName);
+	}
+	else if(fclose(fOut) != 0)
+	{
+		LogPrint("Failed to write '%s'\r\n", tempName);
+
+		remove(tempName);
+
+		outputStats.failed++;
+		global.outputFailed = true;
+	}
+	else
+	{
+		if(CommitOutputFile(tempName, target.fileName))
+			global.outputFiles.push_back(target.fileName);
+		else
+			global.outputFailed = true;
+	}
+}
+
+void EndNode(NodeExport &target, Context &global, SceneFrameCache &cache, FILE *spill, ArchiveWriter *archive)
+{
+	ContextLocal &local = target.local;
+
+	std::vector<Export::NodeInfo> &nodeList = target.nodeList;
+	StringTable &stringData = target.stringData;
+
+	bool nameHashes = global.options.nameHashes;
+
+	// Node that never changes is saved with its constant transformation instead of an animation track
+	std::vector<unsigned> animTrackNodes;
+	std::vector<Export::AnimTrackInfo> animTracks;
+
+	std::vector<unsigned> trackRedirection(local.animatedNodes.size(), ~0u);
+
+	unsigned animKeyCount = 0;
+
+	for(unsigned i = 0; i < local.animatedNodes.size(); i++)
+	{
+		unsigned keyCount = target.trackKeyCount[i];
+
+		if(keyCount <= 1)
+		{
+			if(keyCount == 1)
+			{
+				nodeList[local.animatedNodes[i]].modelOriginal = target.trackValue[i];
+				nodeList[local.animatedNodes[i]].model = target.trackValue[i];
+			}
+
+			LogOptional("  Animated node %d is static\r\n", local.animatedNodes[i]);
+			continue;
+		}
+
+		LogOptional("  Animated node %d has %d keys for %d frames\r\n", local.animatedNodes[i], keyCount, local.animSampleCount);
+
+		Export::AnimTrackInfo track;
+
+		track.firstKey = animKeyCount;
+		track.keyCount = keyCount;
+
+		trackRedirection[i] = animTracks.size();
+
+		animTrackNodes.push_back(local.animatedNodes[i]);
+		animTracks.push_back(track);
+
+		animKeyCount += keyCount;
+	}
+
+	LogPrint("Out of %d animated nodes %d are static, %d keys are used for %d frames\r\n", local.animatedNodes.size(), local.animatedNodes.size() - animTrackNodes.size(), animKeyCount, local.animSampleCount * animTrackNodes.size());
+
+	// Materials are collected first, so that all strings are known before the file is written
+	std::vector<Export::MaterialInfo> materials(local.effects.size());
+
+	for(unsigned i = 0; i < local.effects.size(); i++)
+	{
+		auto&& effect = local.effects[i];
+
+		Export::MaterialInfo &info = materials[i];
+
+		memset(&info, 0, sizeof(info));
+
+		if(effect.diffuseColor != ~0u)
+		{
+			info.colorStringOffset = AppendString(stringData, global.images[effect.diffuseColor].path);
+			info.colorHash = nameHashes ? Export::NameHash(global.images[effect.diffuseColor].path) : 0;
+		}
+
+		if(effect.diffuseAlpha != ~0u)
+		{
+			info.alphaStringOffset = AppendString(stringData, global.images[effect.diffuseAlpha].path);
+			info.alphaHash = nameHashes ? Export::NameHash(global.images[effect.diffuseAlpha].path) : 0;
+		}
+	}
+
+	bool chunked = global.options.animChunkDuration > 0.0 && local.animSampleCount != 0;
+
+	unsigned chunkFrames = chunked ? unsigned(global.options.animChunkDuration / global.animSampleStep + 0.5) : 0;
+
+	if(chunked && chunkFrames == 0)
+		chunkFrames = 1;
+
+	std::vector<Export::AnimChunkInfo> animChunks;
+
+	if(chunked)
+	{
+		for(unsigned firstFrame = 0; firstFrame < local.animSampleCount; firstFrame += chunkFrames)
+		{
+			Export::AnimChunkInfo chunk;
+			memset(&chunk, 0, sizeof(chunk));
+
+			chunk.firstFrame = firstFrame;
+			chunk.frameCount = local.animSampleCount - firstFrame < chunkFrames ? local.animSampleCount - firstFrame : chunkFrames;
+
+			animChunks.push_back(chunk);
+		}
+
+		LogPrint("Saving animation in %d chunks of %d frames\r\n", animChunks.size(), chunkFrames);
+	}
+
+	// Save file header
+	// Object is written out of order, so it is saved to a temporary file that replaces the output or is packed once complete
+	char tempName[512];
+	sprintf(tempName, "%s.part", target.fileName);
+
+	FILE *fOut = fopen(tempName, "w+b");
+
+	if(!fOut)
+	{
+		LogPrint("Failed to open '%s' for writing\r\n", tempName);
+		global.outputFailed = true;
+		return;
+	}
+
+	// Object file is written in many small pieces, a large buffer turns them into few writes
+	setvbuf(fOut, NULL, _IOFBF, 1 << 20);
+
+	LogPrint("Saved file header\r\n");
+
+	unsigned magic = 0x57bedefe;
+	fwrite(&magic, 4, 1, fOut);
+
+	unsigned version = global.options.objectVersion;
+	fwrite(&version, 4, 1, fOut);
+
+	unsigned flags = (chunked ? Export::MF_CHUNKED_ANIMATION : 0) | (nameHashes ? Export::MF_NAME_HASHES : 0);
+	fwrite(&flags, 4, 1, fOut);
+
+	if(version == 5)
+	{
+		SaveMappedSections(target, global, cache, fOut, spill, animTrackNodes, trackRedirection, animTracks, animKeyCount, animChunks, materials);
+
+		CloseNodeFile(target, global, fOut, archive, tempName);
+
+		LogPrint("-------------------------------\r\n");
+		return;
+	}
+
+	// Save nodes
+	LogPrint("Saving nodes\r\n");
+
+	unsigned nodeCount = (unsigned)local.nodes.size();
+	fwrite(&nodeCount, 4, 1, fOut);
+
+	if(!nodeList.empty())
+		fwrite(&nodeList[0], sizeof(Export::NodeInfo), nodeList.size(), fOut);
+
+	// Save skeletons
+	LogPrint("Saving controllers\r\n");
+	unsigned controllerCount= (unsigned)local.skeletons.size();
+	fwrite(&controllerCount, 4, 1, fOut);
+
+	for(unsigned i = 0; i < local.skeletons.size(); i++)
+	{
+		auto&& skeleton = local.skeletons[i];
+
+		LogOptional(" Skeleton %d has %d bones\r\n", i, skeleton.jointCount);
+
+		Export::ControllerInfo sk;
+
+		sk.boneCount = skeleton.jointCount;
+		sk.bindPose = skeleton.bindShapeMat;
+
+		fwrite(&sk, sizeof(sk), 1, fOut);
+
+		// Save node IDs
+		fwrite(local.jointNodes.data() + skeleton.firstJoint, 4, skeleton.jointCount, fOut);
+
+		// Save bind matrices
+		fwrite(local.jointBindMat.data() + skeleton.firstJoint, 64, skeleton.jointCount, fOut);
+
+		// Save bone geometry bounds
+		fwrite(global.contrls[skeleton.controllerID]->bounds, sizeof(aabb), skeleton.jointCount, fOut);
+	}
+
+	unsigned animNodeCount = animTrackNodes.size();
+	fwrite(&animNodeCount, 4, 1, fOut);
+
+	if(!animTrackNodes.empty())
+		fwrite(&animTrackNodes[0], 4, animTrackNodes.size(), fOut);
+
+	fwrite(&local.animSampleCount, 4, 1, fOut);
+
+	uint64_t chunkIndexPos = 0;
+
+	if(chunked)
+	{
+		// Chunk index is filled in after the chunks are saved at the end of the file
+		chunkIndexPos = FileTell(fOut);
+
+		unsigned animChunkCount = animChunks.size();
+		fwrite(&animChunkCount, 4, 1, fOut);
+
+		if(!animChunks.empty())
+			fwrite(&animChunks[0], sizeof(Export::AnimChunkInfo), animChunks.size(), fOut);
+
+		aabb bounds;
+		memset(&bounds, 0, sizeof(aabb));
+
+		fwrite(&bounds, sizeof(aabb), 1, fOut);
+	}
+	else
+	{
+		SaveAnimationTracks(target, cache, fOut, spill, trackRedirection, animTracks, animKeyCount);
+	}
+
+	unsigned materialCount = materials.size();
+	fwrite(&materialCount, 4, 1, fOut);
+
+	if(!materials.empty())
+		fwrite(&materials[0], sizeof(Export::MaterialInfo), materials.size(), fOut);
+
+	unsigned stringSize = stringData.data.size();
+
+	fwrite(&stringSize, 4, 1, fOut);
+	fwrite(stringData.data.data(), 1, stringData.data.size(), fOut);
+
+	LogPrint("Saved %d unique strings (%d bytes)\r\n", stringData.offsets.size(), stringSize);
+
+	if(chunked && !animChunks.empty())
+	{
+		aabb bounds = SaveAnimationChunks(target, fOut, spill, trackRedirection, animTracks.size(), animChunks);
+
+		FileSeek(fOut, chunkIndexPos + 4);
+
+		fwrite(&animChunks[0], sizeof(Export::AnimChunkInfo), animChunks.size(), fOut);
+		fwrite(&bounds, sizeof(aabb), 1, fOut);
+	}
+
+	CloseNodeFile(target, global, fOut, archive, tempName);
+
+	LogPrint("-------------------------------\r\n");
+}
+
+void SaveNodes(std::vector<ExportTarget> &targets, Context &global, ArchiveWriter *archive)
+{
+	SceneFrameCache cache;
+
+	PrepareFrameCache(cache, global);
+
+	std::vector<NodeExport> exports(targets.size());
+
+	unsigned collectStartTime = clock();
+
+	for(unsigned i = 0; i < targets.size(); i++)
+	{
+		strcpy(exports[i].fileName, targets[i].fileName);
+		exports[i].nodeID = targets[i].nodeID;
+
+		BeginNode(exports[i], global, cache);
+	}
+
+	LogPrint("%dms to collect nodes of %d objects (%d bytes per node)\r\n", clock() - collectStartTime, exports.size(), sizeof(DAENode));
+
+	// Window of sampled frames is shared by all exported objects and is the only place where animation is stored in memory
+	char spillName[512];
+	sprintf(spillName, "%s.tmp", targets.empty() ? "colladaconv" : targets[0].fileName);
+
+	FILE *spill = fopen(spillName, "w+b");
+
+	if(!spill)
+	{
+		// Objects can't be saved without their animation, the conversion fails
+		LogPrint("Failed to create temporary file '%s', no objects were saved\r\n", spillName);
+		global.outputFailed = true;
+		return;
+	}
+
+	unsigned sampleCount = global.animSampleCount == -1 ? 0 : global.animSampleCount;
+
+	std::vector<mat4> samples(AnimationWindowSize * global.animatedNodes.size());
+
+	if(sampleCount)
+		LogPrint("Saving %d frames in windows of %d frames (%d bytes per window)\r\n", sampleCount, AnimationWindowSize, sizeof(mat4) * samples.size());
+
+	unsigned cacheTime = 0;
+
+	for(unsigned firstFrame = 0; firstFrame < sampleCount; firstFrame += AnimationWindowSize)
+	{
+		unsigned frameCount = sampleCount - firstFrame < AnimationWindowSize ? sampleCount - firstFrame : AnimationWindowSize;
+
+		SampleAnimation(firstFrame, frameCount, samples.data());
+
+		for(unsigned n = 0; n < frameCount; n++)
+		{
+			const mat4 *frameSamples = samples.data() + n * global.animatedNodes.size();
+
+			unsigned startTime = clock();
+
+			// World transformations are computed once for all objects
+			UpdateFrameCache(cache, global, frameSamples);
+
+			cacheTime += clock() - startTime;
+
+			for(unsigned i = 0; i < exports.size(); i++)
+				SaveNodeFrame(exports[i], global, cache, firstFrame + n, frameSamples);
+		}
+
+		for(unsigned i = 0; i < exports.size(); i++)
+			FlushNodeFrames(exports[i], spill);
+	}
+
+	if(sampleCount)
+		LogPrint("%dms to compute world transformations of %d nodes and bounds of %d bones for %d frames (%s kernels)\r\n", cacheTime, global.nodes.size(), cache.boneNodes.size(), sampleCount, BatchKernelName());
+	else
+		UpdateFrameCache(cache, global, NULL);
+
+	for(unsigned i = 0; i < exports.size(); i++)
+		EndNode(exports[i], global, cache, spill, archive);
+
+	fclose(spill);
+	remove(spillName);
 }